@@ -226,6 +226,7 @@ const int LZ4_minLength = (MFLIMIT+1);
 
 #define LZ4_64KLIMIT ((1<<16) + (MFLIMIT-1))
 #define SKIPSTRENGTH 6     // Increasing this value will make the compression run slower on incompressible data
+#define MAX_ACCELERATION 64
 
 #define MAXD_LOG 16
 #define MAX_DISTANCE ((1 << MAXD_LOG) - 1)
@@ -412,7 +413,8 @@ FORCE_INLINE int LZ4_compress_generic(
 
                  limitedOutput_directive limitedOutput,
                  tableType_t tableType,
-                 prefix64k_directive prefix)
+                 prefix64k_directive prefix,
+                 int acceleration)
 {
     const BYTE* ip = (const BYTE*) source;
     const BYTE* const base = (prefix==withPrefix) ? ((LZ4_Data_Structure*)ctx)->base : (const BYTE*) source;
@@ -430,6 +432,8 @@ FORCE_INLINE int LZ4_compress_generic(
     U32 forwardH;
 
     // Init conditions
+    if (acceleration < 1) acceleration = 1;
+    if (acceleration > MAX_ACCELERATION) acceleration = MAX_ACCELERATION;
     if ((prefix==withPrefix) && (ip != ((LZ4_Data_Structure*)ctx)->nextBlock)) return 0;   // must continue from end of previous block
     if (prefix==withPrefix) ((LZ4_Data_Structure*)ctx)->nextBlock=iend;                    // do it now, due to potential early exit
     if ((tableType == byU16) && (inputSize>=LZ4_64KLIMIT)) return 0;                       // Size too large (not within 64K limit)
@@ -442,7 +446,7 @@ FORCE_INLINE int LZ4_compress_generic(
     // Main Loop
     for ( ; ; )
     {
-        int findMatchAttempts = (1U << skipStrength) + 3;
+        int findMatchAttempts = (acceleration << skipStrength) + 3;
         const BYTE* forwardIp = ip;
         const BYTE* ref;
         BYTE* token;
@@ -555,9 +559,9 @@ int LZ4_compress(const char* source, char* dest, int inputSize)
     int result;
 
     if (inputSize < (int)LZ4_64KLIMIT)
-        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, 0, notLimited, byU16, noPrefix);
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, 0, notLimited, byU16, noPrefix, 1);
     else
-        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, 0, notLimited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix);
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, 0, notLimited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, 1);
 
 #if (HEAPMODE)
     FREEMEM(ctx);
@@ -567,7 +571,7 @@ int LZ4_compress(const char* source, char* dest, int inputSize)
 
 int LZ4_compress_continue (void* LZ4_Data, const char* source, char* dest, int inputSize)
 {
-    return LZ4_compress_generic(LZ4_Data, source, dest, inputSize, 0, notLimited, byU32, withPrefix);
+    return LZ4_compress_generic(LZ4_Data, source, dest, inputSize, 0, notLimited, byU32, withPrefix, 1);
 }
 
 
@@ -581,9 +585,9 @@ int LZ4_compress_limitedOutput(const char* source, char* dest, int inputSize, in
     int result;
 
     if (inputSize < (int)LZ4_64KLIMIT)
-        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix);
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix, 1);
     else
-        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix);
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, 1);
 
 #if (HEAPMODE)
     FREEMEM(ctx);
@@ -593,7 +597,73 @@ int LZ4_compress_limitedOutput(const char* source, char* dest, int inputSize, in
 
 int LZ4_compress_limitedOutput_continue (void* LZ4_Data, const char* source, char* dest, int inputSize, int maxOutputSize)
 {
-    return LZ4_compress_generic(LZ4_Data, source, dest, inputSize, maxOutputSize, limited, byU32, withPrefix);
+    return LZ4_compress_generic(LZ4_Data, source, dest, inputSize, maxOutputSize, limited, byU32, withPrefix, 1);
+}
+
+
+int LZ4_sizeofState(void) { return 1 << MEMORY_USAGE; }
+
+
+int LZ4_compress_withState (void* state, const char* source, char* dest, int inputSize)
+{
+    if (((size_t)(state)&3) != 0) return 0;   // Error : state is not aligned on 4-bytes boundary
+    MEM_INIT(state, 0, LZ4_sizeofState());
+
+    if (inputSize < (int)LZ4_64KLIMIT)
+        return LZ4_compress_generic(state, source, dest, inputSize, 0, notLimited, byU16, noPrefix, 1);
+    else
+        return LZ4_compress_generic(state, source, dest, inputSize, 0, notLimited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, 1);
+}
+
+
+int LZ4_compress_limitedOutput_withState (void* state, const char* source, char* dest, int inputSize, int maxOutputSize)
+{
+    if (((size_t)(state)&3) != 0) return 0;   // Error : state is not aligned on 4-bytes boundary
+    MEM_INIT(state, 0, LZ4_sizeofState());
+
+    if (inputSize < (int)LZ4_64KLIMIT)
+        return LZ4_compress_generic(state, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix, 1);
+    else
+        return LZ4_compress_generic(state, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, 1);
+}
+
+
+int LZ4_compress_fast(const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+{
+#if (HEAPMODE)
+    void* ctx = ALLOCATOR(HASHNBCELLS4, 4);   // Aligned on 4-bytes boundaries
+#else
+    U32 ctx[1U<<(MEMORY_USAGE-2)] = {0};           // Ensure data is aligned on 4-bytes boundaries
+#endif
+    int result;
+
+    if (inputSize < (int)LZ4_64KLIMIT)
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix, acceleration);
+    else
+        result = LZ4_compress_generic((void*)ctx, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, acceleration);
+
+#if (HEAPMODE)
+    FREEMEM(ctx);
+#endif
+    return result;
+}
+
+
+int LZ4_compress_fast_withState (void* state, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+{
+    if (((size_t)(state)&3) != 0) return 0;   // Error : state is not aligned on 4-bytes boundary
+    MEM_INIT(state, 0, LZ4_sizeofState());
+
+    if (inputSize < (int)LZ4_64KLIMIT)
+        return LZ4_compress_generic(state, source, dest, inputSize, maxOutputSize, limited, byU16, noPrefix, acceleration);
+    else
+        return LZ4_compress_generic(state, source, dest, inputSize, maxOutputSize, limited, (sizeof(void*)==8) ? byU32 : byPtr, noPrefix, acceleration);
+}
+
+
+int LZ4_compress_fast_continue (void* LZ4_Data, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+{
+    return LZ4_compress_generic(LZ4_Data, source, dest, inputSize, maxOutputSize, limited, byU32, withPrefix, acceleration);
 }
 
 
@@ -618,6 +688,54 @@ void* LZ4_create (const char* inputBuffer)
 }
 
 
+int LZ4_sizeofStreamState(void) { return sizeof(LZ4_Data_Structure); }
+
+
+int LZ4_resetStreamState (void* state, const char* inputBuffer)
+{
+    if ((((size_t)state) & 3) != 0) return 1;   // Error : pointer is not aligned on 4-bytes boundary
+    LZ4_init((LZ4_Data_Structure*)state, (const BYTE*)inputBuffer);
+    return 0;
+}
+
+
+int LZ4_loadPrefix (void* LZ4_Data, int prefixSize)
+{
+    LZ4_Data_Structure* lz4ds = (LZ4_Data_Structure*)LZ4_Data;
+    const BYTE* p = lz4ds->nextBlock;
+    const BYTE* const end = p + prefixSize;
+
+    if ((prefixSize < 0) || (prefixSize > (int)(64 KB))) return 1;
+    if (lz4ds->nextBlock != lz4ds->bufferStart) return 1;   // only before the first block
+
+    while (p + MINMATCH <= end)
+    {
+        LZ4_putPosition(p, lz4ds->hashTable, byU32, lz4ds->base);
+        p++;
+    }
+    lz4ds->nextBlock = end;
+
+    return 0;
+}
+
+
+int LZ4_copyStreamState (void* state, const void* LZ4_Data, const char* inputBuffer)
+{
+    const LZ4_Data_Structure* src = (const LZ4_Data_Structure*)LZ4_Data;
+    LZ4_Data_Structure* lz4ds = (LZ4_Data_Structure*)state;
+    const BYTE* const ib = (const BYTE*)inputBuffer;
+
+    if ((((size_t)state) & 3) != 0) return 1;   // Error : pointer is not aligned on 4-bytes boundary
+
+    // hashTable only holds positions relative to base
+    memcpy(lz4ds->hashTable, src->hashTable, sizeof(lz4ds->hashTable));
+    lz4ds->bufferStart = ib;
+    lz4ds->base        = ib + (src->base - src->bufferStart);
+    lz4ds->nextBlock   = ib + (src->nextBlock - src->bufferStart);
+    return 0;
+}
+
+
 int LZ4_free (void* LZ4_Data)
 {
     FREEMEM(LZ4_Data);
@@ -135,6 +135,23 @@ LZ4_decompress_safe_partial() :
 */
 
 
+//****************************
+// Advanced Functions
+//****************************
+
+int LZ4_sizeofState(void);
+int LZ4_compress_withState               (void* state, const char* source, char* dest, int inputSize);
+int LZ4_compress_limitedOutput_withState (void* state, const char* source, char* dest, int inputSize, int maxOutputSize);
+
+/*
+These functions are provided should you prefer to allocate memory for compression tables with your own allocation methods,
+typically to reuse it for many blocks instead of initializing a new table on the stack each time.
+LZ4_sizeofState() : size of the memory to provide for 'state'. It must be aligned on 4-bytes boundaries.
+The state is reset by each call, its previous content is never used.
+Their behavior are otherwise identical to LZ4_compress() and LZ4_compress_limitedOutput().
+*/
+
+
 //****************************
 // Stream Functions
 //****************************
@@ -143,6 +160,7 @@ void* LZ4_create (const char* inputBuffer);
 int   LZ4_compress_continue (void* LZ4_Data, const char* source, char* dest, int inputSize);
 int   LZ4_compress_limitedOutput_continue (void* LZ4_Data, const char* source, char* dest, int inputSize, int maxOutputSize);
 char* LZ4_slideInputBuffer (void* LZ4_Data);
+int   LZ4_loadPrefix (void* LZ4_Data, int prefixSize);
 int   LZ4_free (void* LZ4_Data);
 
 /* 
@@ -172,6 +190,37 @@ Note that, for this function to work properly, minimum size of an input buffer m
 Compression can then resume, using LZ4_compress_continue() or LZ4_compress_limitedOutput_continue(), as usual.
 
 When compression is completed, a call to LZ4_free() will release the memory used by the LZ4 Data Structure.
+
+int LZ4_loadPrefix (void* LZ4_Data, int prefixSize);
+Before the first block, references the first 'prefixSize' bytes (<= 64KB) of the input buffer as history,
+without compressing them. The first block must then start at 'inputBuffer + prefixSize'.
+return : 0 on success, or 1 if the prefix is too large or a block was already compressed.
+*/
+
+
+int LZ4_sizeofStreamState(void);
+int LZ4_resetStreamState (void* state, const char* inputBuffer);
+int LZ4_copyStreamState (void* state, const void* LZ4_Data, const char* inputBuffer);
+
+/*
+These functions let the LZ4 Data Structure live in memory provided by the caller, typically to reuse it for many streams.
+LZ4_sizeofStreamState() : size of the LZ4 Data Structure. 'state' must be aligned on 4-bytes boundaries.
+LZ4_resetStreamState() : equivalent of LZ4_create() on existing memory. Do not call LZ4_free() on it.
+LZ4_copyStreamState() : copies an LZ4 Data Structure 'LZ4_Data' into 'state', for a new input buffer which holds the same data.
+    This is typically used to hash a prefix once, with LZ4_loadPrefix(), and start many blocks from it.
+return : 0 on success, or 1 if 'state' is not correctly aligned.
+*/
+
+
+int LZ4_compress_fast            (const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration);
+int LZ4_compress_fast_withState  (void* state, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration);
+int LZ4_compress_fast_continue   (void* LZ4_Data, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration);
+
+/*
+These functions are identical to LZ4_compress_limitedOutput(), LZ4_compress_limitedOutput_withState()
+and LZ4_compress_limitedOutput_continue(), but trade compression ratio for speed with 'acceleration' :
+the match finder starts skipping 'acceleration' positions at a time instead of 1 (1 to 64, values out of range are clamped).
+acceleration 1 is the behavior of the other functions.
 */
 
 
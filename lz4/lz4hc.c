@@ -188,6 +188,7 @@ typedef struct _U64_S { U64 v; } _PACKED U64_S;
 #define HASH_MASK (HASHTABLESIZE - 1)
 
 #define MAX_NB_ATTEMPTS 256
+#define MAX_COMPRESSION_LEVEL 16
 
 #define ML_BITS  4
 #define ML_MASK  (size_t)((1U<<ML_BITS)-1)
@@ -377,6 +378,54 @@ FORCE_INLINE void LZ4HC_Insert (LZ4HC_Data_Structure* hc4, const BYTE* ip)
 }
 
 
+int LZ4_loadPrefixHC (void* LZ4HC_Data, int prefixSize)
+{
+    LZ4HC_Data_Structure* hc4 = (LZ4HC_Data_Structure*)LZ4HC_Data;
+
+    if ((prefixSize < 0) || (prefixSize > (int)(64 KB))) return 1;
+    if (hc4->end != hc4->inputBuffer) return 1;   // only before the first block
+
+    hc4->end += prefixSize;
+    // Positions whose first MINMATCH bytes lay within the prefix only; the others depend on the next block
+    if (prefixSize >= MINMATCH) LZ4HC_Insert(hc4, hc4->end - (MINMATCH-1));
+    return 0;
+}
+
+
+int LZ4_sizeofStateHC(void) { return sizeof(LZ4HC_Data_Structure); }
+
+
+int LZ4_resetStreamStateHC (void* state, const char* inputBuffer)
+{
+    if ((((size_t)state) & (sizeof(void*)-1)) != 0) return 1;   // Error : pointer is not aligned for pointer (32 or 64 bits)
+    LZ4_initHC((LZ4HC_Data_Structure*)state, (const BYTE*)inputBuffer);
+    return 0;
+}
+
+
+int LZ4_copyStreamStateHC (void* state, const void* LZ4HC_Data, const char* inputBuffer)
+{
+    const LZ4HC_Data_Structure* src = (const LZ4HC_Data_Structure*)LZ4HC_Data;
+    LZ4HC_Data_Structure* hc4 = (LZ4HC_Data_Structure*)state;
+    const BYTE* const ib = (const BYTE*)inputBuffer;
+    size_t shift;
+
+    if ((((size_t)state) & (sizeof(void*)-1)) != 0) return 1;   // Error : pointer is not aligned for pointer (32 or 64 bits)
+
+    // chainTable is indexed by absolute position : rotate it onto the new buffer
+    shift = ((size_t)ib - (size_t)src->inputBuffer) & MAXD_MASK;
+    memcpy(hc4->hashTable, src->hashTable, sizeof(hc4->hashTable));
+    memcpy(hc4->chainTable + shift, src->chainTable, (MAXD - shift) * sizeof(U16));
+    memcpy(hc4->chainTable, src->chainTable + (MAXD - shift), shift * sizeof(U16));
+
+    hc4->inputBuffer  = ib;
+    hc4->base         = ib + (src->base - src->inputBuffer);
+    hc4->end          = ib + (src->end - src->inputBuffer);
+    hc4->nextToUpdate = ib + (src->nextToUpdate - src->inputBuffer);
+    return 0;
+}
+
+
 char* LZ4_slideInputBufferHC(void* LZ4HC_Data)
 {
     LZ4HC_Data_Structure* hc4 = (LZ4HC_Data_Structure*)LZ4HC_Data;
@@ -415,13 +464,13 @@ FORCE_INLINE size_t LZ4HC_CommonLength (const BYTE* p1, const BYTE* p2, const BY
 }
 
 
-FORCE_INLINE int LZ4HC_InsertAndFindBestMatch (LZ4HC_Data_Structure* hc4, const BYTE* ip, const BYTE* const matchlimit, const BYTE** matchpos)
+FORCE_INLINE int LZ4HC_InsertAndFindBestMatch (LZ4HC_Data_Structure* hc4, const BYTE* ip, const BYTE* const matchlimit, const BYTE** matchpos, const int maxNbAttempts)
 {
     U16* const chainTable = hc4->chainTable;
     HTYPE* const HashTable = hc4->hashTable;
     const BYTE* ref;
     INITBASE(base,hc4->base);
-    int nbAttempts=MAX_NB_ATTEMPTS;
+    int nbAttempts=maxNbAttempts;
     size_t repl=0, ml=0;
     U16 delta=0;  // useless assignment, to remove an uninitialization warning
 
@@ -483,13 +532,13 @@ FORCE_INLINE int LZ4HC_InsertAndFindBestMatch (LZ4HC_Data_Structure* hc4, const
 }
 
 
-FORCE_INLINE int LZ4HC_InsertAndGetWiderMatch (LZ4HC_Data_Structure* hc4, const BYTE* ip, const BYTE* startLimit, const BYTE* matchlimit, int longest, const BYTE** matchpos, const BYTE** startpos)
+FORCE_INLINE int LZ4HC_InsertAndGetWiderMatch (LZ4HC_Data_Structure* hc4, const BYTE* ip, const BYTE* startLimit, const BYTE* matchlimit, int longest, const BYTE** matchpos, const BYTE** startpos, const int maxNbAttempts)
 {
     U16* const  chainTable = hc4->chainTable;
     HTYPE* const HashTable = hc4->hashTable;
     INITBASE(base,hc4->base);
     const BYTE*  ref;
-    int nbAttempts = MAX_NB_ATTEMPTS;
+    int nbAttempts = maxNbAttempts;
     int delta = (int)(ip-startLimit);
 
     // First Match
@@ -589,6 +638,7 @@ static int LZ4HC_compress_generic (
                  char* dest,
                  int inputSize,
                  int maxOutputSize,
+                 int compressionLevel,
                  limitedOutput_directive limit
                 )
 {
@@ -611,6 +661,11 @@ static int LZ4HC_compress_generic (
     const BYTE* start0;
     const BYTE* ref0;
 
+    // Level : 2^(level-1) match attempts, 0 for the default
+    int maxNbAttempts = MAX_NB_ATTEMPTS;
+    if (compressionLevel > MAX_COMPRESSION_LEVEL) compressionLevel = MAX_COMPRESSION_LEVEL;
+    if (compressionLevel > 0) maxNbAttempts = 1 << (compressionLevel-1);
+
 
     // Ensure blocks follow each other
     if (ip != ctx->end) return 0;
@@ -621,7 +676,7 @@ static int LZ4HC_compress_generic (
     // Main Loop
     while (ip < mflimit)
     {
-        ml = LZ4HC_InsertAndFindBestMatch (ctx, ip, matchlimit, (&ref));
+        ml = LZ4HC_InsertAndFindBestMatch (ctx, ip, matchlimit, (&ref), maxNbAttempts);
         if (!ml) { ip++; continue; }
 
         // saved, in case we would skip too much
@@ -631,7 +686,7 @@ static int LZ4HC_compress_generic (
 
 _Search2:
         if (ip+ml < mflimit)
-            ml2 = LZ4HC_InsertAndGetWiderMatch(ctx, ip + ml - 2, ip + 1, matchlimit, ml, &ref2, &start2);
+            ml2 = LZ4HC_InsertAndGetWiderMatch(ctx, ip + ml - 2, ip + 1, matchlimit, ml, &ref2, &start2, maxNbAttempts);
         else ml2 = ml;
 
         if (ml2 == ml)  // No better match
@@ -680,7 +735,7 @@ _Search3:
         // Now, we have start2 = ip+new_ml, with new_ml = min(ml, OPTIMAL_ML=18)
 
         if (start2 + ml2 < mflimit)
-            ml3 = LZ4HC_InsertAndGetWiderMatch(ctx, start2 + ml2 - 3, start2, matchlimit, ml2, &ref3, &start3);
+            ml3 = LZ4HC_InsertAndGetWiderMatch(ctx, start2 + ml2 - 3, start2, matchlimit, ml2, &ref3, &start3, maxNbAttempts);
         else ml3 = ml2;
 
         if (ml3 == ml2) // No better match : 2 sequences to encode
@@ -786,7 +841,7 @@ int LZ4_compressHC(const char* source, char* dest, int inputSize)
     int result;
     if (ctx==NULL) return 0;
 
-    result = LZ4HC_compress_generic (ctx, source, dest, inputSize, 0, noLimit);
+    result = LZ4HC_compress_generic (ctx, source, dest, inputSize, 0, 0, noLimit);
 
     LZ4_freeHC(ctx);
     return result;
@@ -794,7 +849,7 @@ int LZ4_compressHC(const char* source, char* dest, int inputSize)
 
 int LZ4_compressHC_continue (void* LZ4HC_Data, const char* source, char* dest, int inputSize)
 {
-    return LZ4HC_compress_generic (LZ4HC_Data, source, dest, inputSize, 0, noLimit);
+    return LZ4HC_compress_generic (LZ4HC_Data, source, dest, inputSize, 0, 0, noLimit);
 }
 
 
@@ -804,7 +859,7 @@ int LZ4_compressHC_limitedOutput(const char* source, char* dest, int inputSize,
     int result;
     if (ctx==NULL) return 0;
 
-    result = LZ4HC_compress_generic (ctx, source, dest, inputSize, maxOutputSize, limitedOutput);
+    result = LZ4HC_compress_generic (ctx, source, dest, inputSize, maxOutputSize, 0, limitedOutput);
 
     LZ4_freeHC(ctx);
     return result;
@@ -812,6 +867,45 @@ int LZ4_compressHC_limitedOutput(const char* source, char* dest, int inputSize,
 
 int LZ4_compressHC_limitedOutput_continue (void* LZ4HC_Data, const char* source, char* dest, int inputSize, int maxOutputSize)
 {
-    return LZ4HC_compress_generic (LZ4HC_Data, source, dest, inputSize, maxOutputSize, limitedOutput);
+    return LZ4HC_compress_generic (LZ4HC_Data, source, dest, inputSize, maxOutputSize, 0, limitedOutput);
 }
 
+
+int LZ4_compressHC_withStateHC (void* state, const char* source, char* dest, int inputSize)
+{
+    if (LZ4_resetStreamStateHC(state, source)) return 0;
+    return LZ4HC_compress_generic (state, source, dest, inputSize, 0, 0, noLimit);
+}
+
+
+int LZ4_compressHC_limitedOutput_withStateHC (void* state, const char* source, char* dest, int inputSize, int maxOutputSize)
+{
+    if (LZ4_resetStreamStateHC(state, source)) return 0;
+    return LZ4HC_compress_generic (state, source, dest, inputSize, maxOutputSize, 0, limitedOutput);
+}
+
+
+
+int LZ4_compressHC2_limitedOutput(const char* source, char* dest, int inputSize, int maxOutputSize, int compressionLevel)
+{
+    void* ctx = LZ4_createHC(source);
+    int result;
+    if (ctx==NULL) return 0;
+
+    result = LZ4HC_compress_generic (ctx, source, dest, inputSize, maxOutputSize, compressionLevel, limitedOutput);
+
+    LZ4_freeHC(ctx);
+    return result;
+}
+
+int LZ4_compressHC2_limitedOutput_continue (void* LZ4HC_Data, const char* source, char* dest, int inputSize, int maxOutputSize, int compressionLevel)
+{
+    return LZ4HC_compress_generic (LZ4HC_Data, source, dest, inputSize, maxOutputSize, compressionLevel, limitedOutput);
+}
+
+
+int LZ4_compressHC2_limitedOutput_withStateHC (void* state, const char* source, char* dest, int inputSize, int maxOutputSize, int compressionLevel)
+{
+    if (LZ4_resetStreamStateHC(state, source)) return 0;
+    return LZ4HC_compress_generic (state, source, dest, inputSize, maxOutputSize, compressionLevel, limitedOutput);
+}
@@ -74,6 +74,7 @@ void* LZ4_createHC (const char* inputBuffer);
 int   LZ4_compressHC_continue (void* LZ4HC_Data, const char* source, char* dest, int inputSize);
 int   LZ4_compressHC_limitedOutput_continue (void* LZ4HC_Data, const char* source, char* dest, int inputSize, int maxOutputSize);
 char* LZ4_slideInputBufferHC (void* LZ4HC_Data);
+int   LZ4_loadPrefixHC (void* LZ4HC_Data, int prefixSize);
 int   LZ4_freeHC (void* LZ4HC_Data);
 
 /* 
@@ -103,6 +104,41 @@ Note that, for this function to work properly, minimum size of an input buffer m
 Compression can then resume, using LZ4_compressHC_continue() or LZ4_compressHC_limitedOutput_continue(), as usual.
 
 When compression is completed, a call to LZ4_freeHC() will release the memory used by the LZ4HC Data Structure.
+
+int LZ4_loadPrefixHC (void* LZ4HC_Data, int prefixSize);
+Before the first block, references the first 'prefixSize' bytes (<= 64KB) of the input buffer as history,
+without compressing them. The first block must then start at 'inputBuffer + prefixSize'.
+return : 0 on success, or 1 if the prefix is too large or a block was already compressed.
+*/
+
+
+int LZ4_sizeofStateHC(void);
+int LZ4_compressHC_withStateHC               (void* state, const char* source, char* dest, int inputSize);
+int LZ4_compressHC_limitedOutput_withStateHC (void* state, const char* source, char* dest, int inputSize, int maxOutputSize);
+int LZ4_resetStreamStateHC (void* state, const char* inputBuffer);
+int LZ4_copyStreamStateHC (void* state, const void* LZ4HC_Data, const char* inputBuffer);
+
+/*
+These functions let the LZ4HC Data Structure live in memory provided by the caller,
+typically to reuse it for many blocks instead of allocating a new one for each of them.
+LZ4_sizeofStateHC() : size of the memory to provide for 'state'. It must be aligned on pointer size (32 or 64 bits).
+LZ4_compressHC_withStateHC(), LZ4_compressHC_limitedOutput_withStateHC() :
+    identical to LZ4_compressHC() and LZ4_compressHC_limitedOutput(). The state is reset by each call.
+LZ4_resetStreamStateHC() : equivalent of LZ4_createHC() on existing memory. Do not call LZ4_freeHC() on it.
+LZ4_copyStreamStateHC() : copies an LZ4HC Data Structure 'LZ4HC_Data' into 'state', for a new input buffer which holds the same data.
+    This is typically used to hash a prefix once, with LZ4_loadPrefixHC(), and start many blocks from it.
+return : 0 on success (compressed size for compression functions), or 1 if 'state' is not correctly aligned (0 for compression functions).
+*/
+
+
+int LZ4_compressHC2_limitedOutput                (const char* source, char* dest, int inputSize, int maxOutputSize, int compressionLevel);
+int LZ4_compressHC2_limitedOutput_continue       (void* LZ4HC_Data, const char* source, char* dest, int inputSize, int maxOutputSize, int compressionLevel);
+int LZ4_compressHC2_limitedOutput_withStateHC    (void* state, const char* source, char* dest, int inputSize, int maxOutputSize, int compressionLevel);
+
+/*
+These functions are identical to the ones without '2', but trade speed for compression ratio with 'compressionLevel' :
+the match finder makes up to 2^(compressionLevel-1) attempts per position (1 to 16, higher values are clamped to 16).
+compressionLevel 0 is the default of the other functions, 256 attempts (level 9).
 */
 
 
@@ -1,13 +1,29 @@
 #include <array>
+#include <algorithm>
 #include <atomic>
 #include <cassert>
-#include <future>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
 #include "lz4mt.h"
 #include "lz4mt_xxh32.h"
 #include "lz4mt_mempool.h"
 #include "lz4mt_compat.h"
+#include "lz4mt_dictionary.h"
+#include "lz4mt_executor.h"
+#include "lz4mt_threadpool.h"
+#include "test_clock.h"
 
 
 namespace {
@@ -19,14 +35,38 @@ const uint32_t LZ4S_BLOCKSIZEID_DEFAULT = 7;
 const uint32_t LZ4S_CHECKSUM_SEED = 0;
 const uint32_t LZ4S_EOS = 0;
 const uint32_t LZ4S_MAX_HEADER_SIZE = 4 + 2 + 8 + 4 + 1;
+const int LZ4S_PREFIX_SIZE = 64 * 1024;
+const uint32_t LZ4S_MAGICNUMBER_SEEK_TABLE = LZ4S_MAGICNUMBER_SKIPPABLE_MIN + 0xE;
+const uint32_t LZ4S_SEEK_TABLE_FOOTER_MAGIC = 0x5EEC7AB1;
+const int LZ4S_SEEK_TABLE_FOOTER_SIZE = 4 + 2 + 2 + 4;
 
-typedef std::unique_ptr<Lz4Mt::MemPool::Buffer> BufferPtr;
+typedef Lz4Mt::MemPool::Buffer Buffer;
 
 int getBlockSize(int bdBlockMaximumSize) {
 	assert(bdBlockMaximumSize >= 4 && bdBlockMaximumSize <= 7);
 	return (1 << (8 + (2 * bdBlockMaximumSize)));
 }
 
+// Room after a block in the trusted mode, for padTrusted() and the wild
+// copies of decompressFast.
+int getTrustedPadding(int nBlockMaximumSize) {
+	return nBlockMaximumSize / 255 + 16;
+}
+
+// Written after a block, it stops decompressFast soon after the end of a
+// block it was told is larger than it is : a match at offset 0, which
+// copies within the output (decompressFast may not check offsets), then
+// a literal run longer than originalSize, which it rejects before
+// copying.  Each 0xff adds 255 to the length.
+void padTrusted(char* p, int originalSize) {
+	const auto n = originalSize / 255 + 2;
+	*p++ = 0;		// match offset
+	*p++ = 0;
+	*p++ = '\xf0';	// token, 15 literals or more
+	memset(p, 0xff, n);
+	p[n] = 0;
+}
+
 uint32_t getCheckBits_FromXXH(uint32_t xxh) {
 	return (xxh >> 8) & 0xff;
 }
@@ -111,17 +151,9 @@ validateStreamDescriptor(const Lz4MtStreamDescriptor* sd) {
 	if(1 != sd->flg.versionNumber) {
 		return LZ4MT_RESULT_INVALID_VERSION;
 	}
-	if(0 != sd->flg.presetDictionary) {
-		///	@TODO: Implement Preset Dictionary.
-		return LZ4MT_RESULT_PRESET_DICTIONARY_IS_NOT_SUPPORTED_YET;
-	}
 	if(0 != sd->flg.reserved1) {
 		return LZ4MT_RESULT_INVALID_HEADER;
 	}
-	if(0 == sd->flg.blockIndependence) {
-		///	@TODO: Implement Block Dependency. lz4: r96 - https://code.google.com/p/lz4/source/detail?r=96
-		return LZ4MT_RESULT_BLOCK_DEPENDENCE_IS_NOT_SUPPORTED_YET;
-	}
 	if(sd->bd.blockMaximumSize < 4 || sd->bd.blockMaximumSize > 7) {
 		return LZ4MT_RESULT_INVALID_BLOCK_MAXIMUM_SIZE;
 	}
@@ -134,13 +166,335 @@ validateStreamDescriptor(const Lz4MtStreamDescriptor* sd) {
 	return LZ4MT_RESULT_OK;
 }
 
+// Most blocks srcSize bytes can make.  Split blocks are smaller than the
+// frame's, and every block but the last is full at its own size.
+uint64_t getBlockCountBound(const Lz4MtStreamDescriptor* sd, uint64_t srcSize) {
+	const uint64_t n = getBlockSize(sd->split.blockMaximumSize
+									? sd->split.blockMaximumSize
+									: sd->bd.blockMaximumSize);
+	return (srcSize + n - 1) / n;
+}
+
+// Stores magic number, descriptor and header checksum.  Returns the size.
+int storeFrameHeader(char* d, const Lz4MtStreamDescriptor* sd) {
+	auto* p = d;
+	p += storeU32(p, LZ4S_MAGICNUMBER);
+
+	const auto* sumBegin = p;
+	*p++ = flgToChar(sd->flg);
+	*p++ = bdToChar(sd->bd);
+	if(sd->flg.streamSize) {
+		assert(sd->streamSize);
+		p += storeU64(p, sd->streamSize);
+	}
+	if(sd->flg.presetDictionary) {
+		p += storeU32(p, sd->dictId);
+	}
+
+	const auto sumSize = static_cast<int>(p - sumBegin);
+	const auto h = Lz4Mt::Xxh32(sumBegin, sumSize, LZ4S_CHECKSUM_SEED).digest();
+	*p++ = static_cast<char>(getCheckBits_FromXXH(h));
+	assert(p - d <= static_cast<int>(LZ4S_MAX_HEADER_SIZE));
+	return static_cast<int>(p - d);
+}
+
+int getFrameHeaderSize(const Lz4MtStreamDescriptor* sd) {
+	return 4 + 2
+		+ (sd->flg.streamSize       ? 8 : 0)
+		+ (sd->flg.presetDictionary ? 4 : 0)
+		+ 1;
+}
+
+///	Input read with readAt() alone, from offset 0.  The offset of every
+///	block is known, so workers read their blocks themselves.
+class PositionalInput {
+public:
+	explicit PositionalInput(Lz4MtContext* ctx)
+		: ctx(ctx)
+		, size(ctx->readSize(ctx))
+		, pos(0)
+		, eof(false)
+	{}
+
+	uint64_t position() const {
+		return pos;
+	}
+
+	int read(void* dst, int dstSize) {
+		const auto n = static_cast<int>(
+			std::min<uint64_t>(static_cast<uint64_t>(dstSize), size - pos));
+		const auto r = n > 0 ? ctx->readAt(ctx, dst, n, pos) : 0;
+		if(r > 0) {
+			pos += r;
+		}
+		if(r < dstSize) {
+			eof = true;
+		}
+		return r;
+	}
+
+	// Steps over size bytes, which have to be inside the input.
+	bool skip(uint64_t n) {
+		if(n > size - pos) {
+			pos = size;
+			eof = true;
+			return false;
+		}
+		pos += n;
+		return true;
+	}
+
+	int seek(int offset) {
+		if(offset < 0 && static_cast<uint64_t>(-offset) > pos) {
+			return -1;
+		}
+		pos = std::min(pos + offset, size);
+		eof = false;
+		return 0;
+	}
+
+	int readEof() const {
+		return eof ? 1 : 0;
+	}
+
+	// Called by the workers.
+	int readAt(void* dst, int dstSize, uint64_t offset) const {
+		return ctx->readAt(ctx, dst, dstSize, offset);
+	}
+
+private:
+	PositionalInput(const PositionalInput&);
+	const PositionalInput& operator=(const PositionalInput&);
+
+	Lz4MtContext* ctx;
+	uint64_t size;
+	uint64_t pos;
+	bool eof;
+};
+
+
+///	Counters behind Lz4MtContext::stats.
+///
+///	Threads add with relaxed atomics, and the clock is only read when the
+///	caller asked for stats.  The totals go to the caller's struct once
+///	the workers are done.
+class Stats {
+public:
+	enum Stage {
+		  READ
+		, WINDOW_WAIT
+		, ALLOC_WAIT
+		, CODEC
+		, ORDER_WAIT
+		, WRITE
+		, HASH
+		, N_STAGE
+	};
+
+	enum Counter {
+		  BLOCKS
+		, INCOMPRESSIBLE_BLOCKS
+		, ALLOC_STALLS
+		, BYTES_IN
+		, BYTES_OUT
+		, ADAPTIVE_BLOCKS
+		, N_COUNTER
+	};
+
+	// Per block latencies
+	enum Latency {
+		  CODED			// entered the window to compressed (or decoded)
+		, WRITTEN		// compressed to written, in order
+		, BLOCKED		// waiting for the preceding blocks
+		, N_LATENCY
+	};
+
+	typedef Clock::time_point TimePoint;
+	typedef std::array<std::atomic<uint64_t>, LZ4MT_HISTOGRAM_SIZE> Histogram;
+
+	explicit Stats(bool enable)
+		: enable(enable)
+		, ns()
+		, counts()
+		, histograms()
+		, inFlight(0)
+		, maxInFlight(0)
+	{
+		for(auto& n : ns) {
+			n = 0;
+		}
+		for(auto& n : counts) {
+			n = 0;
+		}
+		for(auto& h : histograms) {
+			for(auto& n : h) {
+				n = 0;
+			}
+		}
+	}
+
+	bool enabled() const {
+		return enable;
+	}
+
+	void add(Counter c, uint64_t n = 1) {
+		if(enable) {
+			counts[c].fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+
+	TimePoint now() const {
+		return enable ? Clock::now() : TimePoint();
+	}
+
+	// A block enters the window (reader thread) and leaves it once
+	// committed.  Returns when it entered.
+	TimePoint enter() {
+		if(enable) {
+			const auto n = inFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+			if(n > maxInFlight) {
+				maxInFlight = n;
+			}
+		}
+		return now();
+	}
+
+	void leave() {
+		if(enable) {
+			inFlight.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	void record(Latency l, uint64_t d) {
+		if(enable) {
+			int i = 0;
+			while(i < LZ4MT_HISTOGRAM_SIZE - 1 && (d >> (i + 1))) {
+				++i;
+			}
+			histograms[l][i].fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	void record(Latency l, const TimePoint& t0, const TimePoint& t1) {
+		if(enable) {
+			record(l, static_cast<uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()));
+		}
+	}
+
+	void addTo(Lz4MtStats* s) const {
+		static std::mutex mut;
+		std::unique_lock<std::mutex> lock(mut);
+		s->readNs				+= ns[READ];
+		s->windowWaitNs			+= ns[WINDOW_WAIT];
+		s->allocWaitNs			+= ns[ALLOC_WAIT];
+		s->codecNs				+= ns[CODEC];
+		s->orderWaitNs			+= ns[ORDER_WAIT];
+		s->writeNs				+= ns[WRITE];
+		s->hashNs				+= ns[HASH];
+		s->blocks				+= counts[BLOCKS];
+		s->incompressibleBlocks	+= counts[INCOMPRESSIBLE_BLOCKS];
+		s->allocStalls			+= counts[ALLOC_STALLS];
+		s->maxInFlight			= std::max(s->maxInFlight, maxInFlight);
+		s->bytesIn				+= counts[BYTES_IN];
+		s->bytesOut				+= counts[BYTES_OUT];
+		s->adaptiveBlocks		+= counts[ADAPTIVE_BLOCKS];
+		for(int i = 0; i < LZ4MT_HISTOGRAM_SIZE; ++i) {
+			s->codedLatency.count[i]	+= histograms[CODED][i];
+			s->writtenLatency.count[i]	+= histograms[WRITTEN][i];
+			s->blockedLatency.count[i]	+= histograms[BLOCKED][i];
+		}
+	}
+
+	///	Adds the lifetime of the timer to stage.
+	class Timer {
+	public:
+		Timer(Stats& stats, Stage stage)
+			: stats(stats.enabled() ? &stats : nullptr)
+			, stage(stage)
+			, t0(this->stats ? Clock::now() : Clock::time_point())
+		{}
+
+		~Timer() {
+			stop();
+		}
+
+		// Returns the nanoseconds added, only once.
+		uint64_t stop() {
+			uint64_t d = 0;
+			if(stats) {
+				d = static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(
+						Clock::now() - t0).count());
+				stats->ns[stage].fetch_add(d, std::memory_order_relaxed);
+				stats = nullptr;
+			}
+			return d;
+		}
+
+	private:
+		Timer(const Timer&);
+		const Timer& operator=(const Timer&);
+
+		Stats* stats;
+		Stage stage;
+		Clock::time_point t0;
+	};
+
+private:
+	Stats(const Stats&);
+	const Stats& operator=(const Stats&);
+
+	bool enable;
+	std::array<std::atomic<uint64_t>, N_STAGE> ns;
+	std::array<std::atomic<uint64_t>, N_COUNTER> counts;
+	std::array<Histogram, N_LATENCY> histograms;
+	std::atomic<uint64_t> inFlight;
+	uint64_t maxInFlight;
+};
+
+
 class Context {
 public:
 	Context(Lz4MtContext* ctx)
 		: ctx(ctx)
 		, mutResult()
+		, positional(nullptr)
+		, stats_(nullptr != ctx->stats)
 	{}
 
+	~Context() {
+		if(ctx->stats) {
+			stats_.addTo(ctx->stats);
+		}
+	}
+
+	Stats& stats() {
+		return stats_;
+	}
+
+	Lz4Mt::MemPool::Buffer alloc(Lz4Mt::MemPool& pool) {
+		if(!stats_.enabled()) {
+			return pool.alloc();
+		}
+		auto b = pool.tryAlloc();
+		if(!b.valid()) {
+			stats_.add(Stats::ALLOC_STALLS);
+			Stats::Timer t(stats_, Stats::ALLOC_WAIT);
+			b = pool.alloc();
+		}
+		return b;
+	}
+
+	// Reads the input through p instead of read().
+	void setPositionalInput(PositionalInput* p) {
+		positional = p;
+	}
+
+	PositionalInput* positionalInput() const {
+		return positional;
+	}
+
 	bool error() const {
 		Lock lock(mutResult);
 		return LZ4MT_RESULT_OK != ctx->result;
@@ -166,7 +520,7 @@ public:
 		}
 
 		char d[sizeof(uint32_t)];
-		if(sizeof(d) != ctx->read(ctx, d, sizeof(d))) {
+		if(sizeof(d) != read(d, sizeof(d))) {
 			setResult(LZ4MT_RESULT_ERROR);
 			return 0;
 		}
@@ -180,7 +534,7 @@ public:
 
 		char d[sizeof(v)];
 		storeU32(d, v);
-		if(sizeof(d) != ctx->write(ctx, d, sizeof(d))) {
+		if(sizeof(d) != write(d, sizeof(d))) {
 			setResult(LZ4MT_RESULT_ERROR);
 			return false;
 		}
@@ -191,7 +545,34 @@ public:
 		if(error()) {
 			return false;
 		}
-		if(size != ctx->write(ctx, ptr, size)) {
+		if(size != write(ptr, size)) {
+			setResult(LZ4MT_RESULT_ERROR);
+			return false;
+		}
+		return true;
+	}
+
+	// One writeGather() call, or one write() per span without it.
+	bool writeSpans(const Lz4MtSpan* spans, int nSpan) {
+		if(error()) {
+			return false;
+		}
+		if(!ctx->writeGather) {
+			for(int i = 0; i < nSpan; ++i) {
+				if(!writeBin(spans[i].ptr, spans[i].size)) {
+					return false;
+				}
+			}
+			return true;
+		}
+		int size = 0;
+		for(int i = 0; i < nSpan; ++i) {
+			size += spans[i].size;
+		}
+		Stats::Timer t(stats_, Stats::WRITE);
+		const auto r = ctx->writeGather(ctx, spans, nSpan);
+		stats_.add(Stats::BYTES_OUT, r > 0 ? r : 0);
+		if(size != r) {
 			setResult(LZ4MT_RESULT_ERROR);
 			return false;
 		}
@@ -202,24 +583,163 @@ public:
 		return ctx->mode;
 	}
 
+	Lz4Mt::MemPool::Policy poolPolicy() const {
+		Lz4Mt::MemPool::Policy p;
+		p.hugePages = 0 != (ctx->mode & LZ4MT_MODE_HUGE_PAGES);
+		p.numaNodes = Lz4Mt::getNumaNodeCount();
+		return p;
+	}
+
+	// nullptr : the call runs its own workers
+	Lz4Mt::Executor* executor() const {
+		if(0 != (ctx->mode & LZ4MT_MODE_SEQUENTIAL) || !ctx->executor) {
+			return nullptr;
+		} else {
+			return &ctx->executor->executor;
+		}
+	}
+
+	unsigned threadCount() const {
+		if(0 != (ctx->mode & LZ4MT_MODE_SEQUENTIAL)) {
+			return 0;
+		} else if(ctx->threadCount) {
+			return ctx->threadCount;
+		} else if(const auto* e = executor()) {
+			return e->size();
+		} else {
+			return Lz4Mt::getHardwareConcurrency();
+		}
+	}
+
+	// Range of the worker index of the tasks.
+	unsigned workerCount() const {
+		if(const auto* e = executor()) {
+			return e->size();
+		} else {
+			return threadCount();
+		}
+	}
+
+	// Blocks in the window, for nThread workers.  Sequential mode
+	// decodes one block at a time.
+	unsigned poolDepth(unsigned nThread) const {
+		if(0 == nThread || 0 == ctx->poolDepth) {
+			return nThread + 1;
+		} else {
+			return ctx->poolDepth;
+		}
+	}
+
+	uint64_t affinityMask() const {
+		return ctx->affinityMask;
+	}
+
 	int read(void* dst, int dstSize) {
-		return ctx->read(ctx, dst, dstSize);
+		Stats::Timer t(stats_, Stats::READ);
+		const auto r = positional ? positional->read(dst, dstSize)
+								  : ctx->read(ctx, dst, dstSize);
+		stats_.add(Stats::BYTES_IN, r > 0 ? r : 0);
+		return r;
 	}
 
 	int readSeek(int offset) {
+		if(positional) {
+			return positional->seek(offset);
+		}
 		return ctx->readSeek(ctx, offset);
 	}
 
 	int readEof() {
+		if(positional) {
+			return positional->readEof();
+		}
 		return ctx->readEof(ctx);
 	}
 
+	bool canReadView() const {
+		return nullptr != ctx->readView && !positional;
+	}
+
+	// readAt() is safe to call from the workers, and the input has a size.
+	bool canReadPositional() const {
+		return 0 != (ctx->mode & LZ4MT_MODE_BLOCK_INDEX)
+			&& nullptr != ctx->readAt
+			&& nullptr != ctx->readSize
+			&& 0 != ctx->readSize(ctx);
+	}
+
+	int readView(const char** ptr, int size) {
+		Stats::Timer t(stats_, Stats::READ);
+		const void* p = nullptr;
+		const auto r = ctx->readView(ctx, &p, size);
+		*ptr = static_cast<const char*>(p);
+		stats_.add(Stats::BYTES_IN, r > 0 ? r : 0);
+		return r;
+	}
+
+	void readRelease(const char* ptr, int size) {
+		if(ctx->readRelease && ptr) {
+			ctx->readRelease(ctx, ptr, size);
+		}
+	}
+
+	bool canReleaseView() const {
+		return nullptr != ctx->readRelease;
+	}
+
+	bool canWriteBorrow() const {
+		return nullptr != ctx->writeBorrow && nullptr != ctx->writeReturn;
+	}
+
+	char* writeBorrow(int size) {
+		return static_cast<char*>(ctx->writeBorrow(ctx, size));
+	}
+
+	// Hands a borrowed buffer back.  Unused buffers go back even after an
+	// error, with size 0.
+	bool writeReturn(char* ptr, int size) {
+		Stats::Timer t(stats_, Stats::WRITE);
+		if(error()) {
+			ctx->writeReturn(ctx, ptr, 0);
+			return false;
+		}
+		stats_.add(Stats::BYTES_OUT, size);
+		if(size != ctx->writeReturn(ctx, ptr, size)) {
+			setResult(LZ4MT_RESULT_ERROR);
+			return false;
+		}
+		return true;
+	}
+
+	char* writeReserve(uint64_t size) {
+		if(!ctx->writeReserve) {
+			return nullptr;
+		}
+		auto* p = static_cast<char*>(ctx->writeReserve(ctx, size));
+		stats_.add(Stats::BYTES_OUT, p ? size : 0);
+		return p;
+	}
+
+	void writeUnreserve(uint64_t size) {
+		if(ctx->writeUnreserve && size) {
+			ctx->writeUnreserve(ctx, size);
+			stats_.add(Stats::BYTES_OUT, uint64_t(0) - size);	// counted back
+		}
+	}
+
 	int readSkippable(uint32_t magicNumber, size_t size) {
+		if(positional) {
+			positional->skip(size);
+			return 0;
+		}
 		return ctx->readSkippable(ctx, magicNumber, size);
 	}
 
 	int write(const void* src, int srcSize) {
-		return ctx->write(ctx, src, srcSize);
+		Stats::Timer t(stats_, Stats::WRITE);
+		const auto r = ctx->write(ctx, src, srcSize);
+		stats_.add(Stats::BYTES_OUT, r > 0 ? r : 0);
+		return r;
 	}
 
 	int compress(const char* src, char* dst, int isize, int maxOutputSize) {
@@ -230,35 +750,1353 @@ public:
 		return ctx->decompress(src, dst, isize, maxOutputSize);
 	}
 
+	bool canLinkBlocks(bool compress) const {
+		return compress ? nullptr != ctx->compressWithPrefix
+						: nullptr != ctx->decompressWithPrefix;
+	}
+
+	bool hasCompressWithState() const {
+		return nullptr != ctx->compressWithState;
+	}
+
+	bool hasStates() const {
+		return nullptr != ctx->stateCreate;
+	}
+
+	int level() const {
+		return ctx->level;
+	}
+
+	// Without states the level never reaches the codec.
+	int adaptiveLevel() const {
+		return ctx->stateCreate ? ctx->adaptiveLevel : 0;
+	}
+
+	void* createState(int level) {
+		return ctx->stateCreate ? ctx->stateCreate(level) : nullptr;
+	}
+
+	void freeState(void* state) {
+		if(state && ctx->stateFree) {
+			ctx->stateFree(state);
+		}
+	}
+
+	int compressWithState(void* state, const char* src, char* dst, int isize, int maxOutputSize) {
+		return ctx->compressWithState(state, src, dst, isize, maxOutputSize);
+	}
+
+	int compressWithPrefix(void* state, const char* src, char* dst, int prefixSize, int isize, int maxOutputSize) {
+		return ctx->compressWithPrefix(state, src, dst, prefixSize, isize, maxOutputSize);
+	}
+
+	int decompressWithPrefix(const char* src, char* dst, int isize, int maxOutputSize) {
+		return ctx->decompressWithPrefix(src, dst, isize, maxOutputSize);
+	}
+
+	bool isTrusted(bool withPrefix) const {
+		return 0 != (ctx->mode & LZ4MT_MODE_TRUSTED)
+			&& nullptr != (withPrefix ? ctx->decompressFastWithPrefix : ctx->decompressFast);
+	}
+
+	int decompressFast(const char* src, char* dst, int originalSize) {
+		return ctx->decompressFast(src, dst, originalSize);
+	}
+
+	int decompressFastWithPrefix(const char* src, char* dst, int originalSize) {
+		return ctx->decompressFastWithPrefix(src, dst, originalSize);
+	}
+
+	Lz4Mt::Dictionary* findDictionary(uint32_t dictId) const {
+		if(!ctx->dictionaries) {
+			return nullptr;
+		}
+		const auto& dicts = ctx->dictionaries->dicts;
+		const auto it = dicts.find(dictId);
+		return dicts.end() != it ? it->second.get() : nullptr;
+	}
+
+	// nullptr : compress with the dictionary as an ordinary prefix
+	const void* dictionaryState(Lz4Mt::Dictionary* dict) const {
+		if(!ctx->compressWithDictionary) {
+			return nullptr;
+		}
+		return dict->state(ctx->dictionaryCreate, ctx->dictionaryFree);
+	}
+
+	int compressWithDictionary(void* state, const void* dictState, const char* src, char* dst, int dictSize, int isize, int maxOutputSize) {
+		return ctx->compressWithDictionary(state, dictState, src, dst, dictSize, isize, maxOutputSize);
+	}
+
 private:
+	Context(const Context&);
+	const Context& operator=(const Context&);
+
 	typedef std::unique_lock<std::mutex> Lock;
 	Lz4MtContext* ctx;
 	mutable std::mutex mutResult;
+	PositionalInput* positional;
+	Stats stats_;
 };
 
 
-} // anonymous namespace
+///	Orders the in-flight blocks of a stream.
+///
+///	At most nWindow sequence numbers are in flight at a time.  Each one is
+///	committed exactly once, in ascending order, even if its block failed.
+class Sequencer {
+public:
+	Sequencer(unsigned nWindow)
+		: nWindow(nWindow)
+		, head(0)
+		, mut()
+		, cond()
+	{}
 
+	// Blocks until seq fits in the window.
+	void acquire(uint64_t seq) {
+		Lock lock(mut);
+		while(seq >= head + nWindow) {
+			cond.wait(lock);
+		}
+	}
 
-extern "C" Lz4MtContext
-lz4mtInitContext()
-{
-	Lz4MtContext e = { LZ4MT_RESULT_OK, 0 };
+	// Blocks until every sequence number before seq is committed.
+	void wait(uint64_t seq) {
+		Lock lock(mut);
+		while(head < seq) {
+			cond.wait(lock);
+		}
+	}
 
-	e.result		= LZ4MT_RESULT_OK;
-	e.readCtx		= nullptr;
-	e.read			= nullptr;
-	e.readEof		= nullptr;
-	e.readSkippable	= nullptr;
-	e.readSeek		= nullptr;
-	e.writeCtx		= nullptr;
-	e.write			= nullptr;
-	e.compress		= nullptr;
-	e.compressBound	= nullptr;
-	e.decompress	= nullptr;
-	e.mode			= LZ4MT_MODE_PARALLEL;
+	void commit(uint64_t seq) {
+		Lock lock(mut);
+		assert(head == seq);
+		head = seq + 1;
+		cond.notify_all();
+	}
 
-	return e;
+private:
+	typedef std::unique_lock<std::mutex> Lock;
+	Sequencer(const Sequencer&);
+	const Sequencer& operator=(const Sequencer&);
+
+	const uint64_t nWindow;
+	uint64_t head;
+	std::mutex mut;
+	std::condition_variable cond;
+};
+
+
+///	Waits for the tasks of a queue which outlives what they refer to,
+///	when that goes out of scope.
+class QueueWait {
+public:
+	explicit QueueWait(Lz4Mt::Executor::Queue& queue)
+		: queue(queue)
+	{}
+
+	~QueueWait() {
+		queue.wait();
+	}
+
+private:
+	QueueWait(const QueueWait&);
+	const QueueWait& operator=(const QueueWait&);
+
+	Lz4Mt::Executor::Queue& queue;
+};
+
+
+///	Compression states of each worker, created by its first block at each
+///	level.  Slot i is only touched by worker i.
+class WorkerStates {
+public:
+	WorkerStates(Context* ctx, unsigned nWorker)
+		: ctx(ctx)
+		, states(nWorker ? nWorker : 1)
+	{}
+
+	~WorkerStates() {
+		for(auto& w : states) {
+			for(auto& s : w) {
+				ctx->freeState(s.second);
+			}
+		}
+	}
+
+	// nullptr : the context has no state callbacks, or stateCreate failed
+	// for this level.  The compress callbacks fail the block then; see
+	// Lz4MtCompressWithState.
+	void* get(unsigned worker, int level) {
+		auto& w = states[worker];
+		for(auto& s : w) {
+			if(s.first == level) {
+				return s.second;
+			}
+		}
+		w.push_back(std::make_pair(level, ctx->createState(level)));
+		return w.back().second;
+	}
+
+private:
+	WorkerStates(const WorkerStates&);
+	const WorkerStates& operator=(const WorkerStates&);
+
+	Context* ctx;
+	std::vector<std::vector<std::pair<int, void*>>> states;
+};
+
+
+///	Last 64KB of a stream, the history of its next linked block.
+class Prefix {
+public:
+	Prefix()
+		: buf(LZ4S_PREFIX_SIZE)
+		, n(0)
+	{}
+
+	void append(const char* p, int size) {
+		if(size >= LZ4S_PREFIX_SIZE) {
+			memcpy(buf.data(), p + size - LZ4S_PREFIX_SIZE, LZ4S_PREFIX_SIZE);
+			n = LZ4S_PREFIX_SIZE;
+		} else {
+			const auto keep = std::min(n, LZ4S_PREFIX_SIZE - size);
+			auto* e = buf.data() + LZ4S_PREFIX_SIZE;
+			memmove(e - size - keep, e - keep, keep);
+			memcpy(e - size, p, size);
+			n = keep + size;
+		}
+	}
+
+	// Copies the history right before dst.
+	void copyTo(char* dst) const {
+		memcpy(dst - n, data(), n);
+	}
+
+	const char* data() const {
+		return buf.data() + LZ4S_PREFIX_SIZE - n;
+	}
+
+	int size() const {
+		return n;
+	}
+
+private:
+	std::vector<char> buf;
+	int n;
+};
+
+
+///	Incompressible block probe, see Lz4MtProbe.
+///
+///	The entropy is estimated from nSpan spans spread evenly over the
+///	block, sampleSize bytes in all.  Small samples read low : a sample
+///	of 4KB of random bytes measures about 7950 millibits per byte.
+class Probe {
+public:
+	explicit Probe(const Lz4MtProbe& p)
+		: p(p)
+		, run(0)
+		, raw(false)
+	{}
+
+	static bool isValid(const Lz4MtProbe& p) {
+		return p.sampleSize >= 0
+			&& p.enterEntropy >= 0 && p.enterEntropy <= 8000
+			&& p.leaveEntropy >= 0 && p.leaveEntropy <= p.enterEntropy
+			&& (0 == p.sampleSize || p.enterBlocks >= 1);
+	}
+
+	bool storeRaw(const char* src, int srcSize) {
+		if(p.sampleSize <= 0) {
+			return false;
+		}
+		const auto e = entropy(src, srcSize);
+		if(raw) {
+			raw = e >= p.leaveEntropy;
+			run = 0;
+		} else {
+			run = (e >= p.enterEntropy) ? run + 1 : 0;
+			raw = run >= p.enterBlocks;
+		}
+		return raw;
+	}
+
+private:
+	enum { nSpan = 16 };
+
+	// millibits per byte
+	int entropy(const char* src, int srcSize) const {
+		uint32_t count[256] = { 0 };
+		const auto add = [&count](const char* q, int n) {
+			for(int i = 0; i < n; ++i) {
+				++count[static_cast<unsigned char>(q[i])];
+			}
+		};
+
+		int n = 0;
+		if(srcSize <= p.sampleSize) {
+			add(src, srcSize);
+			n = srcSize;
+		} else {
+			const auto spanSize = std::max(1, p.sampleSize / nSpan);
+			const auto stride = (srcSize - spanSize) / (nSpan - 1);
+			for(int i = 0; i < nSpan; ++i) {
+				add(src + i * stride, spanSize);
+			}
+			n = spanSize * nSpan;
+		}
+		if(0 == n) {
+			return 0;
+		}
+
+		double h = 0.0;
+		for(const auto c : count) {
+			if(c) {
+				const auto q = static_cast<double>(c) / n;
+				h -= q * std::log(q);
+			}
+		}
+		return static_cast<int>(h / std::log(2.0) * 1000.0);
+	}
+
+	Lz4MtProbe p;
+	int run;
+	bool raw;
+};
+
+
+double getElapsedNs(const Clock::time_point& t0) {
+	return static_cast<double>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			Clock::now() - t0).count());
+}
+
+
+///	Sub-block splitting, see Lz4MtSplit.
+///
+///	Workers report how long each block took to compress.  The recent
+///	cost per byte is a moving average over about four blocks, compared
+///	with the average of the whole stream once each worker had a block.
+///
+///	Unlike the probe, which only looks at the data, splitting and the
+///	adaptive level follow the timings of the run.  With either of them
+///	the same input can give different .lz4 bytes from one run to the
+///	next; the decompressed data is the same.
+class Splitter {
+public:
+	Splitter(const Lz4MtSplit& s, int nBlockMaximumSize, unsigned nWorker)
+		: slowdown(s.slowdown)
+		, nBlockMaximumSize(nBlockMaximumSize)
+		, nSplitSize((s.blockMaximumSize && nWorker > 1)
+					 ? getBlockSize(s.blockMaximumSize) : 0)
+		, nWarmUp(std::max(nWorker, 2u))
+		, mut()
+		, totalNs(0.0)
+		, totalBytes(0.0)
+		, recent(0.0)
+		, count(0)
+		, split(false)
+	{}
+
+	static bool isValid(const Lz4MtSplit& s, const Lz4MtBd& bd) {
+		return 0 == s.blockMaximumSize
+			|| (   s.blockMaximumSize >= 4
+				&& s.blockMaximumSize < bd.blockMaximumSize
+				&& s.slowdown > 100);
+	}
+
+	// Size of the next block, reader thread.
+	int blockSize() {
+		if(!nSplitSize) {
+			return nBlockMaximumSize;
+		}
+		Lock lock(mut);
+		if(count >= nWarmUp) {
+			const auto mean = totalNs / totalBytes;
+			split = split ? recent > mean : recent * 100.0 >= mean * slowdown;
+		}
+		return split ? nSplitSize : nBlockMaximumSize;
+	}
+
+	bool enabled() const {
+		return 0 != nSplitSize;
+	}
+
+	void report(int srcSize, double ns) {
+		if(!nSplitSize || srcSize <= 0) {
+			return;
+		}
+		const auto c = ns / srcSize;
+		Lock lock(mut);
+		totalNs += ns;
+		totalBytes += srcSize;
+		recent = count ? recent + (c - recent) / 4.0 : c;
+		++count;
+	}
+
+private:
+	typedef std::unique_lock<std::mutex> Lock;
+	Splitter(const Splitter&);
+	const Splitter& operator=(const Splitter&);
+
+	const int slowdown;
+	const int nBlockMaximumSize;
+	const int nSplitSize;			// 0 : no split
+	const unsigned nWarmUp;
+	std::mutex mut;
+	double totalNs;
+	double totalBytes;
+	double recent;					// ns per byte
+	unsigned count;
+	bool split;
+};
+
+
+///	Adaptive compression level, see Lz4MtContext::adaptiveLevel.
+///
+///	Workers report the compression time of each block, the reader and
+///	the ordered stage the time spent in the read and write callbacks; all
+///	of them per byte of input, as moving averages over about four blocks.
+///	A block gets adaptiveLevel while that level, shared by the workers,
+///	costs no more than the slower of the input and the output.  The level
+///	is tried once I/O is slower than the other level, until it has been
+///	measured and again nProbe blocks after its last use.
+class Adapter {
+public:
+	Adapter(int level, int adaptiveLevel, unsigned nWorker)
+		: levels()
+		, nWorker(std::max(nWorker, 1u))
+		, mut()
+		, costs()
+		, readCost(0.0)
+		, writeCost(0.0)
+		, sinceAdaptive(0)
+	{
+		levels[0] = level;
+		levels[1] = adaptiveLevel;
+		costs[0] = costs[1] = 0.0;
+	}
+
+	bool enabled() const {
+		return 0 != levels[1] && levels[0] != levels[1];
+	}
+
+	bool isAdaptive(int level) const {
+		return enabled() && level == levels[1];
+	}
+
+	// Level of the next block, reader thread.
+	int next() {
+		if(!enabled()) {
+			return levels[0];
+		}
+		Lock lock(mut);
+		const auto io = std::max(readCost, writeCost);
+		bool adapt = false;
+		if(io > 0.0 && costs[0] > 0.0) {
+			if(costs[1] > 0.0 && sinceAdaptive < nProbe) {
+				adapt = costs[1] / nWorker <= io;
+			} else {
+				adapt = costs[0] / nWorker < io;
+			}
+		}
+		sinceAdaptive = adapt ? 0 : sinceAdaptive + 1;
+		return levels[adapt ? 1 : 0];
+	}
+
+	void reportCodec(int level, int srcSize, double ns) {
+		if(enabled() && srcSize > 0) {
+			Lock lock(mut);
+			update(costs[isAdaptive(level) ? 1 : 0], ns / srcSize);
+		}
+	}
+
+	Clock::time_point start() const {
+		return enabled() ? Clock::now() : Clock::time_point();
+	}
+
+	void reportRead(int srcSize, const Clock::time_point& t0) {
+		if(enabled() && srcSize > 0) {
+			const auto ns = getElapsedNs(t0);
+			Lock lock(mut);
+			update(readCost, ns / srcSize);
+		}
+	}
+
+	void reportWrite(int srcSize, const Clock::time_point& t0) {
+		if(enabled() && srcSize > 0) {
+			const auto ns = getElapsedNs(t0);
+			Lock lock(mut);
+			update(writeCost, ns / srcSize);
+		}
+	}
+
+private:
+	typedef std::unique_lock<std::mutex> Lock;
+	Adapter(const Adapter&);
+	const Adapter& operator=(const Adapter&);
+
+	enum { nProbe = 64 };
+
+	static void update(double& average, double c) {
+		average = (average > 0.0) ? average + (c - average) / 4.0 : c;
+	}
+
+	int levels[2];				// ctx->level, ctx->adaptiveLevel
+	const unsigned nWorker;
+	std::mutex mut;
+	double costs[2];			// ns per byte, 0 : not measured yet
+	double readCost;
+	double writeCost;
+	unsigned sinceAdaptive;		// blocks
+};
+
+
+///	Ordered stage run by whichever worker completes the next block, so
+///	that no worker waits for the blocks in front of its own.
+///
+///	complete(seq) returns true when the caller takes the stage over : it
+///	runs it for head(), calls release() before the slot of that block
+///	can be reused, and goes on while next() finds the following block
+///	complete.  isComplete() tells how many of the following blocks it
+///	may take at once, up to nMaxBatch and less than the window.
+class Drain {
+public:
+	enum { nMaxBatch = 16 };
+
+	explicit Drain(unsigned nWindow)
+		: mut()
+		, completed(nWindow, false)
+		, headSeq(0)
+		, draining(false)
+	{}
+
+	bool complete(uint64_t seq) {
+		Lock lock(mut);
+		completed[seq % completed.size()] = true;
+		if(draining || seq != headSeq) {
+			return false;
+		}
+		draining = true;
+		return true;
+	}
+
+	uint64_t head() const {
+		return headSeq;
+	}
+
+	bool isComplete(uint64_t seq) {
+		Lock lock(mut);
+		return completed[seq % completed.size()];
+	}
+
+	void release() {
+		Lock lock(mut);
+		completed[headSeq % completed.size()] = false;
+	}
+
+	bool next() {
+		Lock lock(mut);
+		++headSeq;
+		if(completed[headSeq % completed.size()]) {
+			return true;
+		}
+		draining = false;
+		return false;
+	}
+
+private:
+	typedef std::unique_lock<std::mutex> Lock;
+	Drain(const Drain&);
+	const Drain& operator=(const Drain&);
+
+	std::mutex mut;
+	std::vector<bool> completed;
+	uint64_t headSeq;			// written by the draining worker only
+	bool draining;
+};
+
+
+///	Slot of the in-flight window.  Slot (sequence % nWindow) is reused
+///	once the previous occupant has been committed.
+struct Block {
+	Block()
+		: sequence(0)
+		, src()
+		, dst()
+		, srcData(nullptr)
+		, dstData(nullptr)
+		, srcLent(nullptr)
+		, dstLent(nullptr)
+		, srcOffset(0)
+		, srcSize(0)
+		, dstSize(0)
+		, prefixSize(0)
+		, incompressible(false)
+		, storeRaw(false)
+		, blockChecksum(0)
+		, frame()
+		, level(0)
+		, entered()
+		, coded()
+	{}
+
+	uint64_t	sequence;
+	Buffer		src;
+	Buffer		dst;
+	const char*	srcData;	// in src, or lent by the input
+	char*		dstData;	// in dst, or in the output region
+	const char*	srcLent;	// span to readRelease(), srcSize bytes
+	char*		dstLent;	// buffer from writeBorrow()
+	uint64_t	srcOffset;	// positional input : the worker reads the block
+	int			srcSize;
+	int			dstSize;
+	int			prefixSize;	// history in front of the data, linked blocks only
+	bool		incompressible;
+	bool		storeRaw;	// the probe skips compression
+	uint32_t	blockChecksum;
+	char		frame[8];	// size and checksum of a block left in the input
+	int			level;		// compression level
+	Stats::TimePoint entered;	// with stats only
+	Stats::TimePoint coded;		// with stats only
+
+private:
+	Block(const Block&);
+	const Block& operator=(const Block&);
+};
+
+
+///	Input and output of lz4mtCompressBuffer() and lz4mtDecompressBuffer().
+///
+///	The input is lent in place.  Output buffers are lent from dst itself,
+///	one after the other, and writeReturn() compacts them : what comes back
+///	always moves down, never over a buffer that is still out.
+struct MemoryIo {
+	MemoryIo(const void* src, size_t srcSize, void* dst, size_t dstCapacity)
+		: src(static_cast<const char*>(src))
+		, srcSize(srcSize)
+		, srcPos(0)
+		, eof(false)
+		, dst(static_cast<char*>(dst))
+		, dstCapacity(dstCapacity)
+		, dstPos(0)
+		, lendPos(0)
+		, lent(0)
+		, lendFailed(false)
+		, overflow(false)
+	{}
+
+	static MemoryIo* get(const Lz4MtContext* ctx) {
+		return static_cast<MemoryIo*>(ctx->readCtx);
+	}
+
+	static void install(Lz4MtContext* ctx, MemoryIo* m) {
+		ctx->readCtx		= m;
+		ctx->read			= read;
+		ctx->readSkippable	= readSkippable;
+		ctx->readSeek		= readSeek;
+		ctx->readEof		= readEof;
+		ctx->readView		= readView;
+		ctx->readRelease	= nullptr;
+		ctx->writeCtx		= m;
+		ctx->write			= write;
+		ctx->writeReserve	= writeReserve;
+		ctx->writeUnreserve	= writeUnreserve;
+		ctx->writeBorrow	= writeBorrow;
+		ctx->writeReturn	= writeReturn;
+		ctx->writeGather	= nullptr;
+	}
+
+	// Like feof(), eof is only raised by a short read.
+	size_t take(size_t size) {
+		const auto n = std::min(size, srcSize - srcPos);
+		if(n < size) {
+			eof = true;
+		}
+		srcPos += n;
+		return n;
+	}
+
+	static int read(Lz4MtContext* ctx, void* dst, int dstSize) {
+		auto* m = get(ctx);
+		const auto* p = m->src + m->srcPos;
+		const auto n = m->take(static_cast<size_t>(dstSize));
+		memcpy(dst, p, n);
+		return static_cast<int>(n);
+	}
+
+	static int readView(Lz4MtContext* ctx, const void** ptr, int size) {
+		auto* m = get(ctx);
+		*ptr = m->src + m->srcPos;
+		return static_cast<int>(m->take(static_cast<size_t>(size)));
+	}
+
+	static int readSkippable(const Lz4MtContext* ctx, uint32_t, size_t size) {
+		auto* m = get(ctx);
+		m->srcPos += std::min(size, m->srcSize - m->srcPos);
+		m->eof = false;
+		return 0;
+	}
+
+	static int readSeek(const Lz4MtContext* ctx, int offset) {
+		auto* m = get(ctx);
+		if(offset < 0 && static_cast<size_t>(-offset) > m->srcPos) {
+			return -1;
+		}
+		m->srcPos = std::min(m->srcPos + offset, m->srcSize);
+		m->eof = false;
+		return 0;
+	}
+
+	static int readEof(const Lz4MtContext* ctx) {
+		return get(ctx)->eof ? 1 : 0;
+	}
+
+	static int write(const Lz4MtContext* ctx, const void* src, int srcSize) {
+		auto* m = get(ctx);
+		const auto n = static_cast<size_t>(srcSize);
+		if(n > m->dstCapacity - m->dstPos) {
+			m->overflow = true;
+			return 0;
+		}
+		memcpy(m->dst + m->dstPos, src, n);
+		m->dstPos += n;
+		return srcSize;
+	}
+
+	static void* writeReserve(const Lz4MtContext* ctx, uint64_t size) {
+		auto* m = get(ctx);
+		if(size > m->dstCapacity - m->dstPos) {
+			return nullptr;
+		}
+		auto* p = m->dst + m->dstPos;
+		m->dstPos += static_cast<size_t>(size);
+		return p;
+	}
+
+	static void writeUnreserve(const Lz4MtContext* ctx, uint64_t size) {
+		auto* m = get(ctx);
+		m->dstPos -= static_cast<size_t>(std::min<uint64_t>(size, m->dstPos));
+	}
+
+	// Once a buffer did not fit, later blocks are written through write() :
+	// a buffer lent after it could be overwritten by them.
+	static void* writeBorrow(const Lz4MtContext* ctx, int size) {
+		auto* m = get(ctx);
+		if(m->lendFailed) {
+			return nullptr;
+		}
+		if(0 == m->lent.load(std::memory_order_acquire)) {
+			m->lendPos = m->dstPos;
+		}
+		const auto n = static_cast<size_t>(size);
+		if(n > m->dstCapacity - m->lendPos) {
+			m->lendFailed = true;
+			return nullptr;
+		}
+		auto* p = m->dst + m->lendPos;
+		m->lendPos += n;
+		m->lent.fetch_add(1, std::memory_order_relaxed);
+		return p;
+	}
+
+	static int writeReturn(const Lz4MtContext* ctx, void* ptr, int size) {
+		auto* m = get(ctx);
+		auto* p = m->dst + m->dstPos;
+		if(p != ptr) {
+			memmove(p, ptr, static_cast<size_t>(size));
+		}
+		m->dstPos += static_cast<size_t>(size);
+		m->lent.fetch_sub(1, std::memory_order_release);
+		return size;
+	}
+
+	const char* src;
+	size_t srcSize;
+	size_t srcPos;
+	bool eof;
+	char* dst;
+	size_t dstCapacity;
+	size_t dstPos;
+	size_t lendPos;
+	std::atomic<int> lent;
+	bool lendFailed;
+	bool overflow;
+
+private:
+	MemoryIo(const MemoryIo&);
+	const MemoryIo& operator=(const MemoryIo&);
+};
+
+
+///	Seek table, a skippable frame following the frame it describes :
+///
+///		magic, size,
+///		{ compressedSize, contentSize } for each block,
+///		blockCount, headerSize (U16), trailerSize (U16), footer magic
+///
+///	compressedSize covers the block size word and the block checksum, so
+///	offsets are sums of sizes.  The footer is at the end of the input,
+///	where readers look for it; headerSize and trailerSize (EOS and stream
+///	checksum) locate the frame in front of the table.
+struct SeekTable {
+	struct Entry {
+		uint32_t	compressedSize;
+		uint32_t	contentSize;
+	};
+
+	SeekTable()
+		: entries()
+		, headerSize(0)
+		, trailerSize(0)
+	{}
+
+	static uint64_t frameSize(uint64_t nBlock) {
+		return 4 + 4 + nBlock * 8 + LZ4S_SEEK_TABLE_FOOTER_SIZE;
+	}
+
+	std::vector<char> store() const {
+		std::vector<char> d(static_cast<size_t>(frameSize(entries.size())));
+		auto* p = d.data();
+		p += storeU32(p, LZ4S_MAGICNUMBER_SEEK_TABLE);
+		p += storeU32(p, static_cast<uint32_t>(d.size() - 8));
+		for(const auto& e : entries) {
+			p += storeU32(p, e.compressedSize);
+			p += storeU32(p, e.contentSize);
+		}
+		p += storeU32(p, static_cast<uint32_t>(entries.size()));
+		p += storeU32(p, static_cast<uint32_t>(headerSize | (trailerSize << 16)));
+		p += storeU32(p, LZ4S_SEEK_TABLE_FOOTER_MAGIC);
+		assert(p == d.data() + d.size());
+		return d;
+	}
+
+	// Reads the table at the end of an input of inputSize bytes.
+	bool load(Lz4MtContext* ctx, uint64_t inputSize) {
+		char f[LZ4S_SEEK_TABLE_FOOTER_SIZE];
+		if(inputSize < frameSize(0)
+		   || sizeof(f) != ctx->readAt(ctx, f, sizeof(f), inputSize - sizeof(f))
+		   || LZ4S_SEEK_TABLE_FOOTER_MAGIC != loadU32(f + 8)
+		) {
+			return false;
+		}
+		const auto nBlock = loadU32(f);
+		const auto n = frameSize(nBlock);
+		if(n > inputSize || n > INT_MAX) {
+			return false;
+		}
+		std::vector<char> d(static_cast<size_t>(n));
+		const auto size = static_cast<int>(n);
+		if(size != ctx->readAt(ctx, d.data(), size, inputSize - n)
+		   || LZ4S_MAGICNUMBER_SEEK_TABLE != loadU32(d.data())
+		   || n - 8 != loadU32(d.data() + 4)
+		) {
+			return false;
+		}
+		const auto* p = d.data() + 8;
+		entries.resize(nBlock);
+		for(auto& e : entries) {
+			e.compressedSize = loadU32(p + 0);
+			e.contentSize    = loadU32(p + 4);
+			p += 8;
+		}
+		const auto sizes = loadU32(f + 4);
+		headerSize  = static_cast<int>(sizes & 0xffff);
+		trailerSize = static_cast<int>(sizes >> 16);
+		return true;
+	}
+
+	std::vector<Entry> entries;
+	int headerSize;
+	int trailerSize;
+};
+
+
+///	Input of lz4mtDecompressRange() : a frame made of the header, the
+///	blocks of the range, read in place with readAt(), and an end mark.
+struct RangeIo {
+	RangeIo(Lz4MtContext* ctx, const char* header, int headerSize
+			, uint64_t blockOffset, uint64_t blockSize
+			, uint64_t skip, uint64_t size)
+		: ctx(ctx)
+		, head(header, header + headerSize)
+		, tail()
+		, blockOffset(blockOffset)
+		, blockSize(blockSize)
+		, pos(0)
+		, eof(false)
+		, skip(skip)
+		, size(size)
+	{
+		char eos[4];
+		storeU32(eos, LZ4S_EOS);
+		tail.assign(eos, eos + sizeof(eos));
+	}
+
+	static RangeIo* get(const Lz4MtContext* ctx) {
+		return static_cast<RangeIo*>(ctx->readCtx);
+	}
+
+	static void install(Lz4MtContext* ctx, RangeIo* m) {
+		ctx->readCtx		= m;
+		ctx->read			= read;
+		ctx->readSkippable	= readSkippable;
+		ctx->readSeek		= readSeek;
+		ctx->readEof		= readEof;
+		ctx->readView		= nullptr;
+		ctx->readRelease	= nullptr;
+		ctx->readAt			= nullptr;
+		ctx->readSize		= nullptr;
+		ctx->writeCtx		= m;
+		ctx->write			= write;
+		ctx->writeReserve	= nullptr;
+		ctx->writeUnreserve	= nullptr;
+		ctx->writeBorrow	= nullptr;
+		ctx->writeReturn	= nullptr;
+		ctx->writeGather	= nullptr;
+	}
+
+	uint64_t streamSize() const {
+		return head.size() + blockSize + tail.size();
+	}
+
+	static int read(Lz4MtContext* ctx, void* dst, int dstSize) {
+		auto* m = get(ctx);
+		auto* d = static_cast<char*>(dst);
+		int n = 0;
+		while(n < dstSize && m->pos < m->streamSize()) {
+			const uint64_t h = m->head.size();
+			const uint64_t b = h + m->blockSize;
+			const auto want = static_cast<uint64_t>(dstSize - n);
+			int r = 0;
+			if(m->pos < h) {
+				r = static_cast<int>(std::min(want, h - m->pos));
+				memcpy(d + n, m->head.data() + m->pos, r);
+			} else if(m->pos < b) {
+				r = static_cast<int>(std::min(want, b - m->pos));
+				r = m->ctx->readAt(m->ctx, d + n, r, m->blockOffset + (m->pos - h));
+				if(r <= 0) {
+					break;
+				}
+			} else {
+				r = static_cast<int>(std::min(want, m->streamSize() - m->pos));
+				memcpy(d + n, m->tail.data() + (m->pos - b), r);
+			}
+			n += r;
+			m->pos += r;
+		}
+		if(n < dstSize) {
+			m->eof = true;
+		}
+		return n;
+	}
+
+	static int readSkippable(const Lz4MtContext* ctx, uint32_t, size_t size) {
+		auto* m = get(ctx);
+		m->pos += std::min<uint64_t>(size, m->streamSize() - m->pos);
+		m->eof = false;
+		return 0;
+	}
+
+	static int readSeek(const Lz4MtContext* ctx, int offset) {
+		auto* m = get(ctx);
+		if(offset < 0 && static_cast<uint64_t>(-offset) > m->pos) {
+			return -1;
+		}
+		m->pos = std::min(m->pos + offset, m->streamSize());
+		m->eof = false;
+		return 0;
+	}
+
+	static int readEof(const Lz4MtContext* ctx) {
+		return get(ctx)->eof ? 1 : 0;
+	}
+
+	// Passes on the part of the content inside the range.
+	static int write(const Lz4MtContext* ctx, const void* src, int srcSize) {
+		auto* m = get(ctx);
+		const auto* p = static_cast<const char*>(src);
+		auto n = static_cast<uint64_t>(srcSize);
+		const auto s = std::min(n, m->skip);
+		m->skip -= s;
+		p += s;
+		n = std::min(n - s, m->size);
+		if(n) {
+			const auto w = static_cast<int>(n);
+			if(w != m->ctx->write(m->ctx, p, w)) {
+				return 0;
+			}
+			m->size -= n;
+		}
+		return srcSize;
+	}
+
+	Lz4MtContext* ctx;
+	std::vector<char> head;
+	std::vector<char> tail;
+	uint64_t blockOffset;
+	uint64_t blockSize;
+	uint64_t pos;
+	bool eof;
+	uint64_t skip;
+	uint64_t size;
+
+private:
+	RangeIo(const RangeIo&);
+	const RangeIo& operator=(const RangeIo&);
+};
+
+
+// Runs f on a copy of ctx whose I/O goes to m.
+template<typename F>
+Lz4MtResult runMemoryIo(Lz4MtContext* ctx, MemoryIo* m, size_t* dstSize, F f) {
+	auto c = *ctx;
+	c.result = LZ4MT_RESULT_OK;
+	MemoryIo::install(&c, m);
+	auto r = f(&c);
+	if(LZ4MT_RESULT_OK != r && m->overflow) {
+		r = LZ4MT_RESULT_OUTPUT_BUFFER_TOO_SMALL;
+	}
+	if(dstSize) {
+		*dstSize = m->dstPos;
+	}
+	ctx->result = r;
+	return r;
+}
+
+///	Input and output of lz4mtStreamBegin().  lz4mtCompress() runs on its
+///	own thread and reads what push() appends, a block at a time.  When a
+///	flush has been asked for, read() returns the data it has, however
+///	short, and flush() waits until the blocks it was handed are written.
+///
+///	Blocks are counted as writeGather() sees them, one span each.  That
+///	only holds because readView and writeBorrow are nullptr here : a raw
+///	block lent by the input goes out as 3 spans, and a borrowed one not
+///	through writeGather() at all, so stored would never catch up with
+///	handed and flush() would not return.
+class StreamIo {
+public:
+	StreamIo(Lz4MtContext* ctx, const Lz4MtStreamDescriptor* sd)
+		: ctx(ctx)
+		, c(*ctx)
+		, sd(*sd)
+		, limit(static_cast<size_t>(getBlockSize(sd->bd.blockMaximumSize)))
+		, mut()
+		, cond()
+		, pending()
+		, pendingPos(0)
+		, flushing(false)
+		, ended(false)
+		, failed(false)
+		, done(false)
+		, handed(0)
+		, stored(0)
+		, streamResult(LZ4MT_RESULT_OK)
+		, thread()
+	{
+		c.result			= LZ4MT_RESULT_OK;
+		c.readCtx			= this;
+		c.read				= read;
+		c.readSkippable		= readSkippable;
+		c.readSeek			= readSeek;
+		c.readEof			= readEof;
+		c.readView			= nullptr;
+		c.readRelease		= nullptr;
+		c.readAt			= nullptr;
+		c.readSize			= nullptr;
+		c.writeCtx			= this;
+		c.write				= write;
+		c.writeReserve		= nullptr;
+		c.writeUnreserve	= nullptr;
+		c.writeBorrow		= nullptr;
+		c.writeReturn		= nullptr;
+		c.writeGather		= writeGather;
+		thread = std::thread([this]() {
+			const auto r = lz4mtCompress(&c, &this->sd);
+			{
+				Lock lock(mut);
+				streamResult = r;
+				done = true;
+			}
+			cond.notify_all();
+		});
+	}
+
+	~StreamIo() {
+		if(thread.joinable()) {
+			end();
+		}
+	}
+
+	// Waits while a block of data is pending.
+	Lz4MtResult push(const void* src, size_t srcSize) {
+		const auto* p = static_cast<const char*>(src);
+		Lock lock(mut);
+		while(srcSize) {
+			while(!done && !failed && pending.size() - pendingPos >= limit) {
+				cond.wait(lock);
+			}
+			if(done || failed) {
+				return failure();
+			}
+			if(pendingPos) {
+				pending.erase(pending.begin(), pending.begin() + pendingPos);
+				pendingPos = 0;
+			}
+			const auto n = std::min(srcSize, limit - pending.size());
+			pending.insert(pending.end(), p, p + n);
+			p += n;
+			srcSize -= n;
+			cond.notify_all();
+		}
+		return LZ4MT_RESULT_OK;
+	}
+
+	Lz4MtResult flush() {
+		Lock lock(mut);
+		flushing = true;
+		cond.notify_all();
+		while(!done && !failed && (pending.size() != pendingPos || stored != handed)) {
+			cond.wait(lock);
+		}
+		flushing = false;
+		return (done || failed) ? failure() : LZ4MT_RESULT_OK;
+	}
+
+	Lz4MtResult end() {
+		{
+			Lock lock(mut);
+			ended = true;
+		}
+		cond.notify_all();
+		thread.join();
+		return ctx->result = streamResult;
+	}
+
+private:
+	typedef std::unique_lock<std::mutex> Lock;
+	StreamIo(const StreamIo&);
+	const StreamIo& operator=(const StreamIo&);
+
+	// The frame only ends before end() when it failed.  Until it has
+	// ended, its result is not known yet.
+	Lz4MtResult failure() const {
+		return LZ4MT_RESULT_OK != streamResult ? streamResult : LZ4MT_RESULT_ERROR;
+	}
+
+	static StreamIo* get(const Lz4MtContext* ctx) {
+		return static_cast<StreamIo*>(ctx->readCtx);
+	}
+
+	static int read(Lz4MtContext* ctx, void* dst, int dstSize) {
+		auto* m = get(ctx);
+		const auto size = static_cast<size_t>(dstSize);
+		Lock lock(m->mut);
+		for(;;) {
+			const auto n = m->pending.size() - m->pendingPos;
+			if(n >= size || (n && m->flushing) || m->ended || m->failed) {
+				break;
+			}
+			m->cond.wait(lock);
+		}
+		const auto n = m->failed ? 0 : std::min(size, m->pending.size() - m->pendingPos);
+		memcpy(dst, m->pending.data() + m->pendingPos, n);
+		m->pendingPos += n;
+		if(m->pending.size() == m->pendingPos) {
+			m->pending.clear();
+			m->pendingPos = 0;
+		}
+		m->handed += n ? 1 : 0;
+		lock.unlock();
+		m->cond.notify_all();
+		return static_cast<int>(n);
+	}
+
+	static int readSkippable(const Lz4MtContext*, uint32_t, size_t) {
+		return -1;
+	}
+
+	static int readSeek(const Lz4MtContext*, int) {
+		return -1;
+	}
+
+	static int readEof(const Lz4MtContext* ctx) {
+		auto* m = get(ctx);
+		Lock lock(m->mut);
+		return (m->ended && m->pending.size() == m->pendingPos) ? 1 : 0;
+	}
+
+	static int write(const Lz4MtContext* ctx, const void* src, int srcSize) {
+		auto* m = get(ctx);
+		auto* u = m->ctx;
+		const auto r = u->write(u, src, srcSize);
+		m->wrote(r == srcSize, 0);
+		return r;
+	}
+
+	static int writeGather(const Lz4MtContext* ctx, const Lz4MtSpan* spans, int nSpan) {
+		auto* m = get(ctx);
+		auto* u = m->ctx;
+		int size = 0;
+		for(int i = 0; i < nSpan; ++i) {
+			size += spans[i].size;
+		}
+		int r = 0;
+		if(u->writeGather) {
+			r = u->writeGather(u, spans, nSpan);
+		} else {
+			for(int i = 0; i < nSpan; ++i) {
+				const auto w = u->write(u, spans[i].ptr, spans[i].size);
+				r += w > 0 ? w : 0;
+				if(w != spans[i].size) {
+					break;
+				}
+			}
+		}
+		m->wrote(r == size, nSpan);
+		return r;
+	}
+
+	void wrote(bool ok, int nBlock) {
+		{
+			Lock lock(mut);
+			failed = failed || !ok;
+			stored += nBlock;
+		}
+		cond.notify_all();
+	}
+
+	Lz4MtContext* ctx;			// of the caller, for its output
+	Lz4MtContext c;				// of lz4mtCompress()
+	Lz4MtStreamDescriptor sd;
+	size_t limit;				// pending data push() waits at
+	std::mutex mut;
+	std::condition_variable cond;
+	std::vector<char> pending;
+	size_t pendingPos;
+	bool flushing;
+	bool ended;
+	bool failed;				// by the output : read() ends the frame
+	bool done;					// lz4mtCompress() returned
+	uint64_t handed;			// blocks read()
+	uint64_t stored;			// blocks written
+	Lz4MtResult streamResult;
+	std::thread thread;
+};
+
+
+} // anonymous namespace
+
+
+struct Lz4MtStream {
+	Lz4MtStream(Lz4MtContext* ctx, const Lz4MtStreamDescriptor* sd)
+		: io(ctx, sd)
+	{}
+
+	StreamIo io;
+};
+
+
+extern "C" Lz4MtContext
+lz4mtInitContext()
+{
+	Lz4MtContext e = { LZ4MT_RESULT_OK, 0 };
+
+	e.result		= LZ4MT_RESULT_OK;
+	e.readCtx		= nullptr;
+	e.read			= nullptr;
+	e.readEof		= nullptr;
+	e.readSkippable	= nullptr;
+	e.readSeek		= nullptr;
+	e.readView		= nullptr;
+	e.readRelease	= nullptr;
+	e.readAt		= nullptr;
+	e.readSize		= nullptr;
+	e.writeCtx		= nullptr;
+	e.write			= nullptr;
+	e.writeReserve	= nullptr;
+	e.writeUnreserve	= nullptr;
+	e.writeBorrow	= nullptr;
+	e.writeReturn	= nullptr;
+	e.writeGather	= nullptr;
+	e.compress		= nullptr;
+	e.compressBound	= nullptr;
+	e.decompress	= nullptr;
+	e.stateCreate			= nullptr;
+	e.stateFree				= nullptr;
+	e.compressWithState		= nullptr;
+	e.compressWithPrefix	= nullptr;
+	e.decompressWithPrefix	= nullptr;
+	e.decompressFast		= nullptr;
+	e.decompressFastWithPrefix	= nullptr;
+	e.dictionaryCreate		= nullptr;
+	e.dictionaryFree		= nullptr;
+	e.compressWithDictionary	= nullptr;
+	e.dictionaries			= nullptr;
+	e.level			= 0;
+	e.adaptiveLevel	= 0;
+	e.mode			= LZ4MT_MODE_PARALLEL;
+	e.threadCount	= 0;
+	e.poolDepth		= 0;
+	e.affinityMask	= 0;
+	e.executor		= nullptr;
+	e.stats			= nullptr;
+
+	return e;
+}
+
+
+extern "C" Lz4MtExecutor*
+lz4mtCreateExecutor(unsigned threadCount, uint64_t memoryLimit, uint64_t affinityMask)
+{
+	const auto n = threadCount ? threadCount : Lz4Mt::getHardwareConcurrency();
+	return new Lz4MtExecutor(n, memoryLimit, affinityMask);
+}
+
+
+extern "C" void
+lz4mtFreeExecutor(Lz4MtExecutor* executor)
+{
+	delete executor;
+}
+
+
+extern "C" Lz4MtStats
+lz4mtInitStats()
+{
+	Lz4MtStats e = { 0 };
+	return e;
+}
+
+
+extern "C" uint64_t
+lz4mtHistogramPercentile(
+	  const Lz4MtHistogram* histogram
+	, double percentile
+) {
+	assert(histogram);
+
+	uint64_t total = 0;
+	for(const auto n : histogram->count) {
+		total += n;
+	}
+	if(0 == total) {
+		return 0;
+	}
+	const auto p = std::max(0.0, std::min(percentile, 100.0));
+	const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(
+		std::ceil(p / 100.0 * static_cast<double>(total))));
+	uint64_t n = 0;
+	int i = 0;
+	for(; i < LZ4MT_HISTOGRAM_SIZE - 1; ++i) {
+		n += histogram->count[i];
+		if(n >= rank) {
+			break;
+		}
+	}
+	return (LZ4MT_HISTOGRAM_SIZE - 1 == i) ? ~uint64_t(0) : uint64_t(2) << i;
 }
 
 
@@ -282,6 +2120,13 @@ lz4mtInitStreamDescriptor()
 	e.streamSize			= 0;
 	e.dictId				= 0;
 
+	e.probe.sampleSize		= 0;
+	e.probe.enterEntropy	= 7800;
+	e.probe.leaveEntropy	= 7500;
+	e.probe.enterBlocks		= 2;
+	e.split.blockMaximumSize	= 0;
+	e.split.slowdown		= 150;
+
 	return e;
 }
 
@@ -339,12 +2184,39 @@ lz4mtResultToString(Lz4MtResult result)
 	case LZ4MT_RESULT_CANNOT_READ_STREAM_CHECKSUM:
 		s = "CANNOT_READ_STREAM_CHECKSUM";
 		break;
+	case LZ4MT_RESULT_BLOCK_CHECKSUM_MISMATCH:
+		s = "BLOCK_CHECKSUM_MISMATCH";
+		break;
 	case LZ4MT_RESULT_STREAM_CHECKSUM_MISMATCH:
 		s = "STREAM_CHECKSUM_MISMATCH";
 		break;
 	case LZ4MT_RESULT_DECOMPRESS_FAIL:
 		s = "DECOMPRESS_FAIL";
 		break;
+	case LZ4MT_RESULT_BAD_ARG:
+		s = "BAD_ARG";
+		break;
+	case LZ4MT_RESULT_DICTIONARY_NOT_FOUND:
+		s = "DICTIONARY_NOT_FOUND";
+		break;
+	case LZ4MT_RESULT_STREAM_SIZE_MISMATCH:
+		s = "STREAM_SIZE_MISMATCH";
+		break;
+	case LZ4MT_RESULT_OUTPUT_BUFFER_TOO_SMALL:
+		s = "OUTPUT_BUFFER_TOO_SMALL";
+		break;
+	case LZ4MT_RESULT_CANNOT_WRITE_SEEK_TABLE:
+		s = "CANNOT_WRITE_SEEK_TABLE";
+		break;
+	case LZ4MT_RESULT_SEEK_TABLE_NOT_FOUND:
+		s = "SEEK_TABLE_NOT_FOUND";
+		break;
+	case LZ4MT_RESULT_RANGE_OUT_OF_BOUNDS:
+		s = "RANGE_OUT_OF_BOUNDS";
+		break;
+	case LZ4MT_RESULT_COMPRESS_FAIL:
+		s = "COMPRESS_FAIL";
+		break;
 	default:
 		s = "Unknown code";
 		break;
@@ -353,6 +2225,37 @@ lz4mtResultToString(Lz4MtResult result)
 }
 
 
+extern "C" Lz4MtResult
+lz4mtAddDictionary(Lz4MtContext* ctx, uint32_t dictId, const void* dict, int dictSize)
+{
+	assert(ctx);
+
+	if(dictSize < 0 || (dictSize > 0 && !dict)) {
+		return LZ4MT_RESULT_BAD_ARG;
+	}
+
+	// Blocks can only reference the last 64KB of their prefix
+	const auto n = std::min(dictSize, LZ4S_PREFIX_SIZE);
+	const auto* p = static_cast<const char*>(dict) + (dictSize - n);
+
+	if(!ctx->dictionaries) {
+		ctx->dictionaries = new Lz4MtDictionaries;
+	}
+	ctx->dictionaries->dicts[dictId].reset(new Lz4Mt::Dictionary(p, n));
+	return LZ4MT_RESULT_OK;
+}
+
+
+extern "C" void
+lz4mtFreeDictionaries(Lz4MtContext* ctx)
+{
+	assert(ctx);
+
+	delete ctx->dictionaries;
+	ctx->dictionaries = nullptr;
+}
+
+
 extern "C" Lz4MtResult
 lz4mtCompress(Lz4MtContext* lz4MtContext, const Lz4MtStreamDescriptor* sd)
 {
@@ -361,34 +2264,31 @@ lz4mtCompress(Lz4MtContext* lz4MtContext, const Lz4MtStreamDescriptor* sd)
 
 	Context ctx_(lz4MtContext);
 	Context* ctx = &ctx_;
+	Lz4Mt::Dictionary* dict = nullptr;
 
 	{
 		char d[LZ4S_MAX_HEADER_SIZE] = { 0 };
-		auto p = &d[0];
 
 		const auto r = validateStreamDescriptor(sd);
 		if(LZ4MT_RESULT_OK != r) {
 			return ctx->setResult(r);
 		}
-		p += storeU32(p, LZ4S_MAGICNUMBER);
-
-		const auto* sumBegin = p;
-		*p++ = flgToChar(sd->flg);
-		*p++ = bdToChar(sd->bd);
-		if(sd->flg.streamSize) {
-			assert(sd->streamSize);
-			p += storeU64(p, sd->streamSize);
+		if(!Probe::isValid(sd->probe) || !Splitter::isValid(sd->split, sd->bd)) {
+			return ctx->setResult(LZ4MT_RESULT_BAD_ARG);
+		}
+		if(0 == sd->flg.blockIndependence && !ctx->canLinkBlocks(true)) {
+			return ctx->setResult(LZ4MT_RESULT_BLOCK_DEPENDENCE_IS_NOT_SUPPORTED_YET);
 		}
 		if(sd->flg.presetDictionary) {
-			p += storeU32(p, sd->dictId);
+			dict = ctx->findDictionary(sd->dictId);
+			if(!dict) {
+				return ctx->setResult(LZ4MT_RESULT_DICTIONARY_NOT_FOUND);
+			}
+			if(!ctx->canLinkBlocks(true)) {
+				return ctx->setResult(LZ4MT_RESULT_PRESET_DICTIONARY_IS_NOT_SUPPORTED_YET);
+			}
 		}
-
-		const auto sumSize = static_cast<int>(p - sumBegin);
-		const auto h = Lz4Mt::Xxh32(sumBegin, sumSize, LZ4S_CHECKSUM_SEED).digest();
-		*p++ = static_cast<char>(getCheckBits_FromXXH(h));
-		assert(p <= std::end(d));
-
-		const auto writeSize = static_cast<int>(p - d);
+		const auto writeSize = storeFrameHeader(d, sd);
 		if(writeSize != ctx->write(d, writeSize)) {
 			return ctx->setResult(LZ4MT_RESULT_CANNOT_WRITE_HEADER);
 		}
@@ -399,103 +2299,360 @@ lz4mtCompress(Lz4MtContext* lz4MtContext, const Lz4MtStreamDescriptor* sd)
 	const auto nBlockCheckSum    = sd->flg.blockChecksum ? 4 : 0;
 	const auto cIncompressible   = 1 << (nBlockSize * 8 - 1);
 	const bool streamChecksum    = 0 != sd->flg.streamChecksum;
-	const bool singleThread      = 0 != (ctx->mode() & LZ4MT_MODE_SEQUENTIAL);
-	const auto nConcurrency      = Lz4Mt::getHardwareConcurrency();
-	const auto nPool             = singleThread ? 1 : nConcurrency + 1;
-	const auto launch            = singleThread ? Lz4Mt::launch::deferred : std::launch::async;
-
-	Lz4Mt::MemPool srcBufferPool(nBlockMaximumSize, nPool);
-	Lz4Mt::MemPool dstBufferPool(nBlockMaximumSize, nPool);
-	std::vector<std::future<void>> futures;
+	const bool linked            = 0 == sd->flg.blockIndependence;
+	const auto nPrefix           = (linked || dict) ? LZ4S_PREFIX_SIZE : 0;
+	const auto nSrcOffset        = nBlockSize + nPrefix;
+	const auto nConcurrency      = ctx->threadCount();
+	const auto nPool             = ctx->poolDepth(nConcurrency);
+
+	const auto policy            = ctx->poolPolicy();
+
+	// Linked blocks are still compressed in parallel : the reader copies
+	// the 64KB history of each block in front of its data.  A preset
+	// dictionary is the history of the first block, and of every block
+	// when they are independent; those blocks start from a clone of the
+	// dictionary's shared state instead of hashing it again.
+	Prefix prefix;
+	if(dict) {
+		prefix.append(dict->data(), dict->size());
+	}
+	const auto* dictState = dict ? ctx->dictionaryState(dict) : nullptr;
+
+	// Lent input is compressed in place.  Its history is used in place
+	// too, as long as the lent spans follow each other in memory.
+	const bool viewInput = ctx->canReadView() && !dict;
+	const char* viewEnd = nullptr;
+	int viewHistory = 0;
+	const bool releaseView = ctx->canReleaseView();
+
+	// Borrowed output receives each whole block : size, data and checksum.
+	const bool lendOutput = ctx->canWriteBorrow();
+
+	// Runs in this thread, on every block in order : its decisions do not
+	// depend on the timing of the workers.
+	Probe probe(sd->probe);
+
+	// Its decisions do depend on that timing, but any block up to
+	// bd.blockMaximumSize makes a valid stream.
+	Splitter splitter(sd->split, nBlockMaximumSize, nConcurrency);
+
+	// So do the levels it picks, which all make valid blocks.
+	Adapter adapter(ctx->level(), ctx->adaptiveLevel(), nConcurrency);
+	const bool timed = splitter.enabled() || adapter.enabled();
+
+	// Filled by the ordered write stage.
+	const bool seekTable = 0 != (ctx->mode() & LZ4MT_MODE_SEEK_TABLE);
+	SeekTable seek;
+	seek.headerSize  = getFrameHeaderSize(sd);
+	seek.trailerSize = 4 + (streamChecksum ? 4 : 0);
+
+	// Both buffers keep room for the size word in front of the data and
+	// the checksum behind it, so that a block goes out in one write.  In
+	// front of the data of a source buffer is its history : the size word
+	// of a raw block replaces its end once the block is compressed.
+	// Compressed data never outgrows the source, or it is stored raw.
+	const Lz4Mt::Executor::Shape shapes[] = {
+		  { static_cast<size_t>(nSrcOffset + nBlockMaximumSize + nBlockCheckSum), nPool, policy }
+		, { static_cast<size_t>(nBlockSize + nBlockMaximumSize + nBlockCheckSum), nPool, policy }
+	};
+	Lz4Mt::Executor::Lease buffers(ctx->executor(), shapes, 2);
+	auto& srcBufferPool = buffers[0];
+	auto& dstBufferPool = buffers[1];
 	Lz4Mt::Xxh32 xxhStream(LZ4S_CHECKSUM_SEED);
+	Drain drain(nPool);
+	Sequencer hashSequencer(nPool);
+	std::vector<Block> blocks(nPool);
+	WorkerStates states(ctx, ctx->workerCount());
+
+	// Fills in the size word at p and the checksum behind the data which
+	// follows it, and returns the size of the whole block.
+	const auto frameBlock =
+		[nBlockSize, nBlockCheckSum, cIncompressible] (char* p, const Block* b) -> int
+	{
+		storeU32(p, b->dstSize | (b->incompressible ? cIncompressible : 0));
+		auto n = nBlockSize + b->dstSize;
+		if(nBlockCheckSum) {
+			storeU32(p + n, b->blockChecksum);
+			n += nBlockCheckSum;
+		}
+		return n;
+	};
 
-	const auto f =
-		[&futures, &dstBufferPool, &xxhStream
-		 , ctx, nBlockCheckSum, streamChecksum, launch, cIncompressible
+	// Stored in order by whichever worker completes the next block, so
+	// that the others go on with the window instead of waiting for it.
+	// A run of completed blocks goes out in one gathered write.
+	const auto store =
+		[&xxhStream, &seek, &adapter, &frameBlock, &blocks
+		 , ctx, seekTable, nBlockSize, nBlockCheckSum, nSrcOffset, nPool, streamChecksum, cIncompressible
 		 ]
-		(int i, Lz4Mt::MemPool::Buffer* srcRawPtr, int srcSize)
+		(uint64_t first, uint64_t last)
 	{
-		BufferPtr src(srcRawPtr);
-		if(ctx->error()) {
-			return;
+		Lz4MtSpan spans[3 * Drain::nMaxBatch];
+		int nSpan = 0;
+		int srcSize = 0;
+		const auto flush = [&]() {
+			ctx->writeSpans(spans, nSpan);
+			nSpan = 0;
+		};
+
+		const auto t0 = adapter.start();
+		for(auto seq = first; seq <= last; ++seq) {
+			auto* b = &blocks[seq % nPool];
+			const auto* srcPtr = b->srcData;
+			ctx->stats().record(Stats::BLOCKED, b->coded, ctx->stats().now());
+			srcSize += b->srcSize;
+
+			if(b->dstLent) {
+				flush();
+				auto* p = b->dstLent;
+				ctx->writeReturn(p, ctx->error() ? 0 : frameBlock(p, b));
+				b->dstLent = nullptr;
+				continue;
+			}
+			if(ctx->error()) {
+				continue;
+			}
+			char* p = nullptr;
+			if(!b->incompressible) {
+				p = b->dst.data();
+			} else if(b->src.valid() && srcPtr == b->src.data() + nSrcOffset) {
+				p = b->src.data() + nSrcOffset - nBlockSize;
+			}
+			if(p) {
+				spans[nSpan].ptr = p;
+				spans[nSpan].size = frameBlock(p, b);
+				++nSpan;
+			} else {
+				// raw data lent by the input
+				auto* w = b->frame;
+				storeU32(w, b->dstSize | cIncompressible);
+				spans[nSpan].ptr = w;
+				spans[nSpan].size = nBlockSize;
+				++nSpan;
+				spans[nSpan].ptr = srcPtr;
+				spans[nSpan].size = b->dstSize;
+				++nSpan;
+				if(nBlockCheckSum) {
+					storeU32(w + nBlockSize, b->blockChecksum);
+					spans[nSpan].ptr = w + nBlockSize;
+					spans[nSpan].size = nBlockCheckSum;
+					++nSpan;
+				}
+			}
 		}
+		flush();
+		adapter.reportWrite(srcSize, t0);
+
+		for(auto seq = first; seq <= last; ++seq) {
+			auto* b = &blocks[seq % nPool];
+			const auto* srcPtr = b->srcData;
+			if(seekTable && !ctx->error()) {
+				const SeekTable::Entry e = {
+					  static_cast<uint32_t>(nBlockSize + b->dstSize + nBlockCheckSum)
+					, static_cast<uint32_t>(b->srcSize)
+				};
+				seek.entries.push_back(e);
+			}
 
-		const auto* srcPtr = src->data();
-		BufferPtr dst(dstBufferPool.alloc());
-		auto* cmpPtr = dst->data();
-		const auto cmpSize = ctx->compress(srcPtr, cmpPtr, srcSize, srcSize);
-		const bool incompressible = (cmpSize <= 0);
-		const auto* cPtr  = incompressible ? srcPtr  : cmpPtr;
-		const auto  cSize = incompressible ? srcSize : cmpSize;
+			b->dst.reset();
+			ctx->stats().record(Stats::WRITTEN, b->coded, ctx->stats().now());
 
-		std::future<uint32_t> futureBlockHash;
-		if(nBlockCheckSum) {
-			futureBlockHash = std::async(launch, [=] {
-				return Lz4Mt::Xxh32(cPtr, cSize, LZ4S_CHECKSUM_SEED).digest();
-			});
+			if(streamChecksum && !ctx->error()) {
+				Stats::Timer t(ctx->stats(), Stats::HASH);
+				xxhStream.update(srcPtr, b->srcSize);
+			}
+			ctx->readRelease(b->srcLent, b->srcSize);
+			b->srcLent = nullptr;
+			b->src.reset();
+			ctx->stats().leave();
 		}
+	};
 
-		if(incompressible) {
-			dst.reset();
-		}
+	const auto f =
+		[&dstBufferPool, &store, &drain, &hashSequencer, &states, &splitter, &adapter
+		 , ctx, nBlockSize, nBlockCheckSum, linked, nPrefix, dictState, nPool, timed
+		 ]
+		(Block* b, unsigned worker)
+	{
+		const auto* srcPtr = b->srcData;
+
+		if(!ctx->error()) {
+			char* cmpPtr = nullptr;
+			if(b->dstLent) {
+				cmpPtr = b->dstLent + nBlockSize;
+			} else if(!b->storeRaw) {
+				b->dst = ctx->alloc(dstBufferPool);
+				cmpPtr = b->dst.data() + nBlockSize;
+			}
+			auto* state = states.get(worker, b->level);
+			int cmpSize = 0;
+			{
+				Stats::Timer t(ctx->stats(), Stats::CODEC);
+				const auto t0 = timed ? Clock::now() : Clock::time_point();
+				if(b->storeRaw) {
+					// stored raw below
+				} else if(dictState && (!linked || 0 == b->sequence)) {
+					cmpSize = ctx->compressWithDictionary(
+						state, dictState, srcPtr, cmpPtr, b->prefixSize, b->srcSize, b->srcSize);
+				} else if(nPrefix) {
+					cmpSize = ctx->compressWithPrefix(
+						state, srcPtr, cmpPtr, b->prefixSize, b->srcSize, b->srcSize);
+				} else if(ctx->hasStates() && ctx->hasCompressWithState()) {
+					cmpSize = ctx->compressWithState(state, srcPtr, cmpPtr, b->srcSize, b->srcSize);
+				} else {
+					cmpSize = ctx->compress(srcPtr, cmpPtr, b->srcSize, b->srcSize);
+				}
+				if(timed && !b->storeRaw) {
+					const auto ns = getElapsedNs(t0);
+					splitter.report(b->srcSize, ns);
+					adapter.reportCodec(b->level, b->srcSize, ns);
+				}
+			}
+			if(!b->storeRaw && adapter.isAdaptive(b->level)) {
+				ctx->stats().add(Stats::ADAPTIVE_BLOCKS);
+			}
+			if(cmpSize < 0) {
+				ctx->setResult(LZ4MT_RESULT_COMPRESS_FAIL);
+			}
+			b->incompressible = (cmpSize <= 0);
+			if(b->incompressible) {
+				b->dst.reset();
+				b->dstSize = b->srcSize;
+				if(b->dstLent) {
+					memcpy(cmpPtr, srcPtr, b->srcSize);
+				}
+				ctx->stats().add(Stats::INCOMPRESSIBLE_BLOCKS);
+			} else {
+				b->dstSize = cmpSize;
+			}
 
-		if(i > 0) {
-			futures[i-1].wait();
+			if(nBlockCheckSum) {
+				Stats::Timer t(ctx->stats(), Stats::HASH);
+				const auto* cPtr = (b->incompressible && !b->dstLent) ? srcPtr : cmpPtr;
+				b->blockChecksum =
+					Lz4Mt::Xxh32(cPtr, b->dstSize, LZ4S_CHECKSUM_SEED).digest();
+			}
 		}
 
-		std::future<void> futureStreamHash;
-		if(streamChecksum) {
-			futureStreamHash = std::async(launch, [=, &xxhStream] {
-				xxhStream.update(srcPtr, srcSize);
-			});
+		b->coded = ctx->stats().now();
+		ctx->stats().record(Stats::CODED, b->entered, b->coded);
+		if(!drain.complete(b->sequence)) {
+			return;
 		}
+		const auto nBatch = std::min<uint64_t>(Drain::nMaxBatch, nPool);
+		do {
+			const auto first = drain.head();
+			auto last = first;
+			while(last + 1 - first < nBatch && drain.isComplete(last + 1)) {
+				++last;
+			}
+			store(first, last);
+			for(auto seq = first; ; ++seq) {
+				drain.release();
+				hashSequencer.commit(seq);
+				if(seq == last) {
+					break;
+				}
+				drain.next();
+			}
+		} while(drain.next());
+	};
 
-		if(incompressible) {
-			ctx->writeU32(cSize | cIncompressible);
-			ctx->writeBin(srcPtr, srcSize);
-		} else {
-			ctx->writeU32(cSize);
-			ctx->writeBin(cmpPtr, cmpSize);
-		}
+	// Last, so that it waits for the workers before f, and whatever f
+	// refers to, goes : the worker which drains may still be in f after
+	// the final commit.
+	Lz4Mt::Executor::Queue threadPool(ctx->executor(), nPool
+									  , nConcurrency, ctx->affinityMask());
 
-		if(futureBlockHash.valid()) {
-			ctx->writeU32(futureBlockHash.get());
+	uint64_t seq = 0;
+	for(;; ++seq) {
+		{
+			Stats::Timer t(ctx->stats(), Stats::WINDOW_WAIT);
+			hashSequencer.acquire(seq);
 		}
-
-		if(futureStreamHash.valid()) {
-			futureStreamHash.wait();
+		auto* b = &blocks[seq % nPool];
+		const char* srcPtr = nullptr;
+		int readSize = 0;
+		bool copyPrefix = 0 != nPrefix;
+		const auto nReadSize = splitter.blockSize();
+
+		if(viewInput) {
+			const auto t0 = adapter.start();
+			readSize = ctx->readView(&srcPtr, nReadSize);
+			adapter.reportRead(readSize, t0);
+			const auto before = (srcPtr == viewEnd) ? viewHistory : 0;
+			viewHistory = std::min(before + readSize, LZ4S_PREFIX_SIZE);
+			viewEnd = srcPtr + readSize;
+			if(readSize > 0) {
+				b->srcLent = srcPtr;
+			}
+			if(readSize > 0 && linked && (before < prefix.size() || releaseView)) {
+				// history is not in front of the lent span, or may be
+				// released before this block is compressed : copy both
+				b->src = ctx->alloc(srcBufferPool);
+				auto* p = b->src.data() + nSrcOffset;
+				memcpy(p, srcPtr, readSize);
+				srcPtr = p;
+			} else {
+				copyPrefix = false;
+			}
+		} else {
+			b->src = ctx->alloc(srcBufferPool);
+			auto* p = b->src.data() + nSrcOffset;
+			const auto t0 = adapter.start();
+			readSize = ctx->read(p, nReadSize);
+			adapter.reportRead(readSize, t0);
+			srcPtr = p;
 		}
-	};
-
-	for(int i = 0;; ++i) {
-		BufferPtr src(srcBufferPool.alloc());
-		auto* srcPtr = src->data();
-		const auto srcSize = src->size();
-		const auto readSize = ctx->read(srcPtr, static_cast<int>(srcSize));
 
 		if(0 == readSize) {
+			b->src.reset();
 			break;
 		}
 
-		if(singleThread) {
-			f(0, src.release(), readSize);
-		} else {
-			futures.emplace_back(std::async(launch, f, i, src.release(), readSize));
+		if(lendOutput) {
+			b->dstLent = ctx->writeBorrow(nBlockSize + readSize + nBlockCheckSum);
+		}
+
+		b->sequence   = seq;
+		b->srcData    = srcPtr;
+		b->srcSize    = readSize;
+		b->prefixSize = nPrefix ? prefix.size() : 0;
+		b->storeRaw   = probe.storeRaw(srcPtr, readSize);
+		b->level      = b->storeRaw ? ctx->level() : adapter.next();
+		if(copyPrefix) {
+			prefix.copyTo(b->src.data() + nSrcOffset);
+		}
+		if(linked) {
+			prefix.append(srcPtr, readSize);
 		}
+		ctx->stats().add(Stats::BLOCKS);
+		b->entered = ctx->stats().enter();
+		threadPool.submit([&f, b](unsigned worker) {
+			f(b, worker);
+		});
 	}
 
-	for(auto& e : futures) {
-		e.wait();
+	{
+		Stats::Timer t(ctx->stats(), Stats::WINDOW_WAIT);
+		hashSequencer.wait(seq);
 	}
 
 	if(!ctx->writeU32(LZ4S_EOS)) {
-		return LZ4MT_RESULT_CANNOT_WRITE_EOS;
+		return ctx->setResult(LZ4MT_RESULT_CANNOT_WRITE_EOS);
 	}
 
 	if(streamChecksum) {
 		const auto digest = xxhStream.digest();
 		if(!ctx->writeU32(digest)) {
-			return LZ4MT_RESULT_CANNOT_WRITE_STREAM_CHECKSUM;
+			return ctx->setResult(LZ4MT_RESULT_CANNOT_WRITE_STREAM_CHECKSUM);
+		}
+	}
+
+	if(seekTable) {
+		const auto d = seek.store();
+		if(!ctx->writeBin(d.data(), static_cast<int>(d.size()))) {
+			return ctx->setResult(LZ4MT_RESULT_CANNOT_WRITE_SEEK_TABLE);
 		}
 	}
 
@@ -512,7 +2669,18 @@ lz4mtDecompress(Lz4MtContext* lz4MtContext, Lz4MtStreamDescriptor* sd)
 	Context ctx_(lz4MtContext);
 	Context* ctx = &ctx_;
 
+	// With a block index the reader only parses block sizes; each worker
+	// reads its own block.
+	std::unique_ptr<PositionalInput> positional;
+	if(ctx->canReadPositional()) {
+		positional.reset(new PositionalInput(lz4MtContext));
+		ctx->setPositionalInput(positional.get());
+	}
+
 	std::atomic<bool> quit(false);
+	const auto nConcurrency = ctx->threadCount();
+	Lz4Mt::Executor::Queue threadPool(ctx->executor(), ctx->poolDepth(nConcurrency)
+									  , nConcurrency, ctx->affinityMask());
 
 	ctx->setResult(LZ4MT_RESULT_OK);
 	while(!quit && !ctx->error() && !ctx->readEof()) {
@@ -561,6 +2729,14 @@ lz4mtDecompress(Lz4MtContext* lz4MtContext, Lz4MtStreamDescriptor* sd)
 			ctx->setResult(r);
 			break;
 		}
+		if(0 == sd->flg.blockIndependence && !ctx->canLinkBlocks(false)) {
+			ctx->setResult(LZ4MT_RESULT_BLOCK_DEPENDENCE_IS_NOT_SUPPORTED_YET);
+			break;
+		}
+		if(sd->flg.presetDictionary && !ctx->canLinkBlocks(false)) {
+			ctx->setResult(LZ4MT_RESULT_PRESET_DICTIONARY_IS_NOT_SUPPORTED_YET);
+			break;
+		}
 
 		const int nExInfo =
 			  (sd->flg.streamSize       ? sizeof(uint64_t) : 0)
@@ -594,101 +2770,243 @@ lz4mtDecompress(Lz4MtContext* lz4MtContext, Lz4MtStreamDescriptor* sd)
 			break;
 		}
 
+		const auto* dict = sd->flg.presetDictionary ? ctx->findDictionary(sd->dictId) : nullptr;
+		if(sd->flg.presetDictionary && !dict) {
+			ctx->setResult(LZ4MT_RESULT_DICTIONARY_NOT_FOUND);
+			break;
+		}
+
 		const auto nBlockMaximumSize = getBlockSize(sd->bd.blockMaximumSize);
 		const auto nBlockCheckSum    = sd->flg.blockChecksum ? 4 : 0;
 		const bool streamChecksum    = 0 != sd->flg.streamChecksum;
-		const bool singleThread      = 0 != (ctx->mode() & LZ4MT_MODE_SEQUENTIAL);
-		const auto nConcurrency      = Lz4Mt::getHardwareConcurrency();
-		const auto nPool             = singleThread ? 1 : nConcurrency + 1;
-		const auto launch            = singleThread ? Lz4Mt::launch::deferred : std::launch::async;
-
-		Lz4Mt::MemPool srcBufferPool(nBlockMaximumSize, nPool);
-		Lz4Mt::MemPool dstBufferPool(nBlockMaximumSize, nPool);
-		std::vector<std::future<void>> futures;
+		const bool linked            = 0 == sd->flg.blockIndependence;
+		const auto nPrefix           = (linked || dict) ? LZ4S_PREFIX_SIZE : 0;
+		const auto nPool             = ctx->poolDepth(nConcurrency);
+		const bool trusted           = ctx->isTrusted(0 != nPrefix);
+		const auto nSrcPadding       = trusted ? getTrustedPadding(nBlockMaximumSize) : 0;
+		const auto nStreamSize       = sd->flg.streamSize ? sd->streamSize : 0;
+
+		const auto policy            = ctx->poolPolicy();
+
+		// A linked block can only be decoded after its predecessor, so
+		// decoding becomes an ordered stage.  Checksums, writing and
+		// hashing stay pipelined.  Independent blocks with a dictionary
+		// all decode in parallel against the same, constant prefix.
+		Prefix prefix;
+		if(dict) {
+			prefix.append(dict->data(), dict->size());
+		}
+		// With a known stream size the output may provide the whole frame
+		// at once.  Workers then decode in place, at the offset the block
+		// has when every block before it is full : the ordered stage only
+		// moves a block when some block before it was short.
+		char* region = nullptr;
+		uint64_t regionSize = 0;
+		uint64_t regionPos = 0;
+		if(sd->flg.streamSize && sd->streamSize && !nPrefix) {
+			region = ctx->writeReserve(sd->streamSize);
+			regionSize = region ? sd->streamSize : 0;
+		}
+		const bool viewInput = ctx->canReadView();
+		const char* viewPending = nullptr;
+		int viewPendingSize = 0;
+
+		// Borrowed output is handed back from the hash stage, and so is
+		// the output of blocks which could not borrow, to keep the order.
+		const bool lendOutput = !region && !nPrefix && ctx->canWriteBorrow();
+
+		const Lz4Mt::Executor::Shape shapes[] = {
+			  { static_cast<size_t>(nBlockMaximumSize + nSrcPadding), nPool, policy }
+			, { static_cast<size_t>(nPrefix + nBlockMaximumSize), nPool, policy }
+		};
+		Lz4Mt::Executor::Lease buffers(ctx->executor(), shapes, 2);
+		auto& srcBufferPool = buffers[0];
+		auto& dstBufferPool = buffers[1];
 		Lz4Mt::Xxh32 xxhStream(LZ4S_CHECKSUM_SEED);
+		Sequencer decodeSequencer(nPool);
+		Sequencer writeSequencer(nPool);
+		Sequencer hashSequencer(nPool);
+		std::vector<Block> blocks(nPool);
+
+		auto* const input = positional.get();
+
+		// Decodes b into room bytes at dst.  A trusted block in a padded
+		// buffer is decoded as full first, or as the rest of the stream.
+		const auto decode = [
+			ctx, trusted, nBlockMaximumSize, nStreamSize
+		] (Block* b, char* dst, int room, bool withPrefix) -> int
+		{
+			const auto offset = b->sequence * nBlockMaximumSize;
+			uint64_t size = std::min(nBlockMaximumSize, room);
+			if(nStreamSize) {
+				size = offset < nStreamSize ? std::min(size, nStreamSize - offset) : 0;
+			}
+			if(trusted && size && b->src.valid() && b->srcData == b->src.data()) {
+				const auto n = static_cast<int>(size);
+				padTrusted(b->src.data() + b->srcSize, n);
+				const auto r = withPrefix
+					? ctx->decompressFastWithPrefix(b->srcData, dst, n)
+					: ctx->decompressFast(b->srcData, dst, n);
+				if(r == b->srcSize) {
+					return n;
+				}
+			}
+			return withPrefix
+				? ctx->decompressWithPrefix(b->srcData, dst, b->srcSize, room)
+				: ctx->decompress(b->srcData, dst, b->srcSize, room);
+		};
 
 		const auto f = [
-			&futures, &dstBufferPool, &xxhStream, &quit
-			, ctx, nBlockCheckSum, streamChecksum, launch
-		] (int i, Lz4Mt::MemPool::Buffer* srcRaw, bool incompressible, uint32_t blockChecksum)
+			&srcBufferPool, &dstBufferPool, &xxhStream, &quit, &writeSequencer, &hashSequencer
+			, &decodeSequencer, &prefix, &regionPos, &decode
+			, ctx, nBlockCheckSum, streamChecksum, linked, nPrefix, nBlockMaximumSize
+			, region, regionSize, lendOutput, input
+		] (Block* b)
 		{
-			BufferPtr src(srcRaw);
-			if(ctx->error() || quit) {
-				return;
+			uint64_t blocked = 0;
+			if(input && !ctx->error() && !quit) {
+				b->src = ctx->alloc(srcBufferPool);
+				b->srcData = b->src.data();
+				Stats::Timer t(ctx->stats(), Stats::READ);
+				ctx->stats().add(Stats::BYTES_IN, b->srcSize);
+				if(b->srcSize != input->readAt(b->src.data(), b->srcSize, b->srcOffset)) {
+					quit = true;
+					ctx->setResult(LZ4MT_RESULT_CANNOT_READ_BLOCK_DATA);
+				}
 			}
 
-			const auto* srcPtr = src->data();
-			const auto srcSize = static_cast<int>(src->size());
+			const auto* srcPtr = b->srcData;
 
-			std::future<uint32_t> futureBlockHash;
-			if(nBlockCheckSum) {
-				futureBlockHash = std::async(launch, [=] {
-					return Lz4Mt::Xxh32(srcPtr, srcSize, LZ4S_CHECKSUM_SEED).digest();
-				});
+			if(!ctx->error() && !quit) {
+				if(nBlockCheckSum) {
+					Stats::Timer t(ctx->stats(), Stats::HASH);
+					const auto bh = Lz4Mt::Xxh32(srcPtr, b->srcSize, LZ4S_CHECKSUM_SEED).digest();
+					if(bh != b->blockChecksum) {
+						quit = true;
+						ctx->setResult(LZ4MT_RESULT_BLOCK_CHECKSUM_MISMATCH);
+					}
+				}
 			}
 
-			if(incompressible) {
-				if(i > 0) {
-					futures[i-1].wait();
-				}
+			if(linked) {
+				Stats::Timer t(ctx->stats(), Stats::ORDER_WAIT);
+				decodeSequencer.wait(b->sequence);
+				blocked += t.stop();
+			}
 
-				std::future<void> futureStreamHash;
-				if(streamChecksum) {
-					futureStreamHash = std::async(
-						  launch
-						, [&xxhStream, srcPtr, srcSize] {
-							xxhStream.update(srcPtr, srcSize);
-						}
-					);
+			Stats::Timer codecTimer(ctx->stats(), Stats::CODEC);
+			b->dstData = nullptr;
+			if(ctx->error() || quit) {
+				// nothing to decode
+			} else if(b->incompressible) {
+				b->dstSize = b->srcSize;
+				if(b->dstLent) {
+					memcpy(b->dstLent, srcPtr, b->srcSize);
+					b->dstData = b->dstLent;
 				}
-				ctx->writeBin(srcPtr, srcSize);
-				if(futureStreamHash.valid()) {
-					futureStreamHash.wait();
+			} else if(b->dstLent) {
+				b->dstSize = decode(b, b->dstLent, nBlockMaximumSize, false);
+				b->dstData = b->dstLent;
+				if(b->dstSize < 0) {
+					quit = true;
+					ctx->setResult(LZ4MT_RESULT_DECOMPRESS_FAIL);
 				}
 			} else {
-				BufferPtr dst(dstBufferPool.alloc());
-
-				auto* dstPtr = dst->data();
-				const auto dstSize = dst->size();
-				const auto decSize = ctx->decompress(
-					srcPtr, dstPtr, srcSize, static_cast<int>(dstSize));
+				int decSize = -1;
+				const auto offset = b->sequence * nBlockMaximumSize;
+				if(region && offset < regionSize) {
+					const auto room = std::min<uint64_t>(nBlockMaximumSize, regionSize - offset);
+					auto* dstPtr = region + static_cast<size_t>(offset);
+					decSize = decode(b, dstPtr, static_cast<int>(room), false);
+					if(decSize >= 0) {
+						b->dstData = dstPtr;
+					}
+				}
+				if(!b->dstData) {
+					b->dst = ctx->alloc(dstBufferPool);
+					auto* dstPtr = b->dst.data() + nPrefix;
+					if(nPrefix) {
+						prefix.copyTo(dstPtr);
+					}
+					decSize = decode(b, dstPtr, nBlockMaximumSize, 0 != nPrefix);
+					b->dstData = dstPtr;
+				}
 				if(decSize < 0) {
 					quit = true;
 					ctx->setResult(LZ4MT_RESULT_DECOMPRESS_FAIL);
-					return;
 				}
+				b->dstSize = decSize;
+			}
+			codecTimer.stop();
 
-				if(i > 0) {
-					futures[i-1].wait();
-				}
+			const char* outPtr = (b->incompressible && !b->dstLent) ? srcPtr : b->dstData;
 
-				std::future<void> futureStreamHash;
-				if(streamChecksum) {
-					futureStreamHash = std::async(
-						  launch
-						, [&xxhStream, dstPtr, decSize] {
-							xxhStream.update(dstPtr, decSize);
-						}
-					);
-				}
-				ctx->writeBin(dstPtr, decSize);
-				if(futureStreamHash.valid()) {
-					futureStreamHash.wait();
+			if(linked) {
+				if(!ctx->error() && !quit) {
+					prefix.append(outPtr, b->dstSize);
 				}
+				decodeSequencer.commit(b->sequence);
 			}
 
-			if(futureBlockHash.valid()) {
-				auto bh = futureBlockHash.get();
-				if(bh != blockChecksum) {
-					quit = true;
-					ctx->setResult(LZ4MT_RESULT_BLOCK_CHECKSUM_MISMATCH);
-					return;
+			const auto coded = ctx->stats().now();
+			ctx->stats().record(Stats::CODED, b->entered, coded);
+			{
+				Stats::Timer t(ctx->stats(), Stats::ORDER_WAIT);
+				writeSequencer.wait(b->sequence);
+				blocked += t.stop();
+			}
+
+			if(ctx->error() || quit || lendOutput) {
+				// nothing to write
+			} else if(!region) {
+				ctx->writeBin(outPtr, b->dstSize);
+			} else if(regionPos + b->dstSize > regionSize) {
+				quit = true;
+				ctx->setResult(LZ4MT_RESULT_STREAM_SIZE_MISMATCH);
+			} else {
+				auto* p = region + static_cast<size_t>(regionPos);
+				if(p != outPtr) {
+					memmove(p, outPtr, b->dstSize);
 				}
+				outPtr = p;
+				regionPos += b->dstSize;
 			}
-			return;
+			if(!b->incompressible) {
+				b->src.reset();
+			}
+			ctx->stats().record(Stats::WRITTEN, coded, ctx->stats().now());
+			writeSequencer.commit(b->sequence);
+
+			{
+				Stats::Timer t(ctx->stats(), Stats::ORDER_WAIT);
+				hashSequencer.wait(b->sequence);
+				blocked += t.stop();
+			}
+			if(streamChecksum && !ctx->error() && !quit) {
+				Stats::Timer t(ctx->stats(), Stats::HASH);
+				xxhStream.update(outPtr, b->dstSize);
+			}
+			if(b->dstLent) {
+				ctx->writeReturn(b->dstLent, quit ? 0 : b->dstSize);
+				b->dstLent = nullptr;
+			} else if(lendOutput && !quit) {
+				ctx->writeBin(outPtr, b->dstSize);
+			}
+			ctx->readRelease(b->srcLent, b->srcSize);
+			b->srcLent = nullptr;
+			b->src.reset();
+			b->dst.reset();
+			ctx->stats().record(Stats::BLOCKED, blocked);
+			ctx->stats().leave();
+			hashSequencer.commit(b->sequence);
 		};
 
-		for(int i = 0; !quit && !ctx->readEof(); ++i) {
+		// The queue serves every frame, but f and the blocks are this
+		// frame's : a worker may still be in f after its last commit.
+		const QueueWait queueWait(threadPool);
+
+		uint64_t seq = 0;
+		for(; !quit && !ctx->readEof(); ++seq) {
 			const auto srcBits = ctx->readU32();
 			if(ctx->error()) {
 				quit = true;
@@ -704,34 +3022,81 @@ lz4mtDecompress(Lz4MtContext* lz4MtContext, Lz4MtStreamDescriptor* sd)
 			const bool incompressible = 0 != (srcBits & incompMask);
 			const auto srcSize        = static_cast<int>(srcBits & ~incompMask);
 
-			BufferPtr src(srcBufferPool.alloc());
-			const auto readSize = ctx->read(src->data(), srcSize);
+			if(srcSize > nBlockMaximumSize) {
+				quit = true;
+				ctx->setResult(LZ4MT_RESULT_CANNOT_READ_BLOCK_DATA);
+				break;
+			}
+
+			{
+				Stats::Timer t(ctx->stats(), Stats::WINDOW_WAIT);
+				hashSequencer.acquire(seq);
+			}
+			auto* b = &blocks[seq % nPool];
+			int readSize = 0;
+			if(input) {
+				b->srcOffset = input->position();
+				readSize = input->skip(srcSize) ? srcSize : 0;
+			} else if(viewInput) {
+				readSize = ctx->readView(&b->srcData, srcSize);
+				if(readSize > 0) {
+					viewPending = b->srcData;
+					viewPendingSize = readSize;
+				}
+			} else {
+				b->src = ctx->alloc(srcBufferPool);
+				b->srcData = b->src.data();
+				readSize = ctx->read(b->src.data(), srcSize);
+			}
 			if(srcSize != readSize || ctx->error()) {
+				b->src.reset();
 				quit = true;
 				ctx->setResult(LZ4MT_RESULT_CANNOT_READ_BLOCK_DATA);
 				break;
 			}
-			src->resize(readSize);
 
 			const auto blockCheckSum = nBlockCheckSum ? ctx->readU32() : 0;
 			if(ctx->error()) {
+				b->src.reset();
 				quit = true;
 				ctx->setResult(LZ4MT_RESULT_CANNOT_READ_BLOCK_CHECKSUM);
 				break;
 			}
 
-			if(singleThread) {
-				f(0, src.release(), incompressible, blockCheckSum);
-			} else {
-				futures.emplace_back(std::async(
-					  launch
-					, f, i, src.release(), incompressible, blockCheckSum
-				));
+			b->sequence       = seq;
+			b->srcSize        = readSize;
+			b->incompressible = incompressible;
+			b->blockChecksum  = blockCheckSum;
+			b->srcLent        = viewPending;
+			viewPending       = nullptr;
+			if(lendOutput) {
+				b->dstLent = ctx->writeBorrow(incompressible ? srcSize : nBlockMaximumSize);
 			}
+			ctx->stats().add(Stats::BLOCKS);
+			ctx->stats().add(Stats::INCOMPRESSIBLE_BLOCKS, incompressible ? 1 : 0);
+			b->entered = ctx->stats().enter();
+			threadPool.submit([&f, b](unsigned) {
+				f(b);
+			});
 		}
 
-		for(auto& e : futures) {
-			e.wait();
+		{
+			Stats::Timer t(ctx->stats(), Stats::WINDOW_WAIT);
+			hashSequencer.wait(seq);
+		}
+
+		// a block that was not read completely goes back after the others
+		ctx->readRelease(viewPending, viewPendingSize);
+
+		// The header's stream size is not trusted beyond the blocks : what
+		// they did not fill is given back, so that a frame which fails, or
+		// claims too much, does not leave an output of that size.
+		if(region) {
+			ctx->writeUnreserve(regionSize - regionPos);
+		}
+		if(region && !ctx->error() && regionPos != regionSize) {
+			ctx->setResult(LZ4MT_RESULT_STREAM_SIZE_MISMATCH);
+			break;
 		}
 
 		if(!ctx->error() && streamChecksum) {
@@ -749,3 +3114,268 @@ lz4mtDecompress(Lz4MtContext* lz4MtContext, Lz4MtStreamDescriptor* sd)
 
 	return ctx->result();
 }
+
+
+extern "C" uint64_t
+lz4mtCompressFrameBound(const Lz4MtStreamDescriptor* sd, uint64_t srcSize)
+{
+	assert(sd);
+
+	if(LZ4MT_RESULT_OK != validateStreamDescriptor(sd)) {
+		return 0;
+	}
+
+	const uint64_t nBlock   = getBlockCountBound(sd, srcSize);
+	const uint64_t nHeader  = 4 + 2 + 1
+							+ (sd->flg.streamSize       ? 8 : 0)
+							+ (sd->flg.presetDictionary ? 4 : 0);
+	const uint64_t nPerBlock = 4 + (sd->flg.blockChecksum ? 4 : 0);
+	const uint64_t nTrailer = 4 + (sd->flg.streamChecksum ? 4 : 0);
+
+	// incompressible blocks are stored as they are
+	return nHeader + srcSize + nBlock * nPerBlock + nTrailer;
+}
+
+
+extern "C" uint64_t
+lz4mtSeekTableBound(const Lz4MtStreamDescriptor* sd, uint64_t srcSize)
+{
+	assert(sd);
+
+	if(LZ4MT_RESULT_OK != validateStreamDescriptor(sd)) {
+		return 0;
+	}
+
+	return SeekTable::frameSize(getBlockCountBound(sd, srcSize));
+}
+
+
+extern "C" Lz4MtResult
+lz4mtDecompressRange(
+	  Lz4MtContext* ctx
+	, Lz4MtStreamDescriptor* sd
+	, uint64_t offset
+	, uint64_t size
+) {
+	assert(ctx);
+	assert(sd);
+
+	if(!ctx->readAt || !ctx->readSize) {
+		return ctx->result = LZ4MT_RESULT_BAD_ARG;
+	}
+
+	SeekTable seek;
+	const auto inputSize = ctx->readSize(ctx);
+	if(!seek.load(ctx, inputSize)) {
+		return ctx->result = LZ4MT_RESULT_SEEK_TABLE_NOT_FOUND;
+	}
+
+	uint64_t frameSize = seek.headerSize + seek.trailerSize;
+	uint64_t contentSize = 0;
+	for(const auto& e : seek.entries) {
+		frameSize += e.compressedSize;
+		contentSize += e.contentSize;
+	}
+	const auto tableSize = SeekTable::frameSize(seek.entries.size());
+	if(seek.headerSize > static_cast<int>(LZ4S_MAX_HEADER_SIZE)
+	   || frameSize + tableSize > inputSize
+	) {
+		return ctx->result = LZ4MT_RESULT_SEEK_TABLE_NOT_FOUND;
+	}
+	const auto frameOffset = inputSize - tableSize - frameSize;
+
+	char d[LZ4S_MAX_HEADER_SIZE] = { 0 };
+	if(seek.headerSize != ctx->readAt(ctx, d, seek.headerSize, frameOffset)) {
+		return ctx->result = LZ4MT_RESULT_INVALID_HEADER;
+	}
+	if(LZ4S_MAGICNUMBER != loadU32(d)) {
+		return ctx->result = LZ4MT_RESULT_INVALID_MAGIC_NUMBER;
+	}
+	*sd = lz4mtInitStreamDescriptor();
+	sd->flg = charToFlg(d[4]);
+	sd->bd  = charToBc(d[5]);
+	const auto r = validateStreamDescriptor(sd);
+	if(LZ4MT_RESULT_OK != r) {
+		return ctx->result = r;
+	}
+	if(seek.headerSize != getFrameHeaderSize(sd)) {
+		return ctx->result = LZ4MT_RESULT_INVALID_HEADER;
+	}
+	{
+		const auto* p = d + 6;
+		if(sd->flg.streamSize) {
+			sd->streamSize = loadU64(p);
+			p += sizeof(uint64_t);
+		}
+		if(sd->flg.presetDictionary) {
+			sd->dictId = loadU32(p);
+			p += sizeof(uint32_t);
+		}
+		const auto h = Lz4Mt::Xxh32(d + 4, static_cast<int>(p - (d + 4)), LZ4S_CHECKSUM_SEED).digest();
+		if(static_cast<char>(getCheckBits_FromXXH(h)) != *p) {
+			return ctx->result = LZ4MT_RESULT_INVALID_HEADER_CHECKSUM;
+		}
+	}
+
+	if(offset > contentSize || size > contentSize - offset) {
+		return ctx->result = LZ4MT_RESULT_RANGE_OUT_OF_BOUNDS;
+	}
+
+	// Blocks [first, last) hold the range.  Linked blocks need all of
+	// their predecessors.
+	const bool linked = 0 == sd->flg.blockIndependence;
+	size_t first = 0;
+	size_t last = 0;
+	uint64_t firstContent = 0;
+	uint64_t firstBlock = 0;
+	uint64_t lastBlock = 0;
+	{
+		uint64_t c = 0;
+		uint64_t b = 0;
+		for(const auto& e : seek.entries) {
+			if(c + e.contentSize <= offset && !linked) {
+				++first;
+				firstContent += e.contentSize;
+				firstBlock += e.compressedSize;
+			}
+			if(c >= offset + size) {
+				break;
+			}
+			c += e.contentSize;
+			b += e.compressedSize;
+			++last;
+		}
+		lastBlock = b;
+	}
+	if(0 == size || first >= last) {
+		return ctx->result = LZ4MT_RESULT_OK;
+	}
+
+	// The partial frame has neither a stream checksum nor a size.
+	auto rsd = *sd;
+	rsd.flg.streamChecksum = 0;
+	rsd.flg.streamSize = 0;
+	rsd.streamSize = 0;
+	char h[LZ4S_MAX_HEADER_SIZE] = { 0 };
+	const auto hSize = storeFrameHeader(h, &rsd);
+
+	RangeIo m(ctx, h, hSize
+			  , frameOffset + seek.headerSize + firstBlock, lastBlock - firstBlock
+			  , offset - firstContent, size);
+	auto c = *ctx;
+	c.result = LZ4MT_RESULT_OK;
+	RangeIo::install(&c, &m);
+	const auto e = lz4mtDecompress(&c, &rsd);
+	return ctx->result = e;
+}
+
+
+extern "C" Lz4MtResult
+lz4mtCompressBuffer(
+	  Lz4MtContext* ctx
+	, const Lz4MtStreamDescriptor* sd
+	, const void* src
+	, size_t srcSize
+	, void* dst
+	, size_t dstCapacity
+	, size_t* dstSize
+) {
+	assert(ctx);
+	assert(sd);
+
+	if(dstSize) {
+		*dstSize = 0;
+	}
+	if((!src && srcSize) || (!dst && dstCapacity)
+	   || (sd->flg.streamSize && sd->streamSize != srcSize)
+	) {
+		return ctx->result = LZ4MT_RESULT_BAD_ARG;
+	}
+
+	MemoryIo m(src, srcSize, dst, dstCapacity);
+	return runMemoryIo(ctx, &m, dstSize, [sd](Lz4MtContext* c) {
+		return lz4mtCompress(c, sd);
+	});
+}
+
+
+extern "C" Lz4MtResult
+lz4mtDecompressBuffer(
+	  Lz4MtContext* ctx
+	, Lz4MtStreamDescriptor* sd
+	, const void* src
+	, size_t srcSize
+	, void* dst
+	, size_t dstCapacity
+	, size_t* dstSize
+) {
+	assert(ctx);
+	assert(sd);
+
+	if(dstSize) {
+		*dstSize = 0;
+	}
+	if((!src && srcSize) || (!dst && dstCapacity)) {
+		return ctx->result = LZ4MT_RESULT_BAD_ARG;
+	}
+
+	MemoryIo m(src, srcSize, dst, dstCapacity);
+	return runMemoryIo(ctx, &m, dstSize, [sd](Lz4MtContext* c) {
+		return lz4mtDecompress(c, sd);
+	});
+}
+
+
+extern "C" Lz4MtStream*
+lz4mtStreamBegin(
+	  Lz4MtContext* ctx
+	, const Lz4MtStreamDescriptor* sd
+) {
+	assert(ctx);
+	assert(sd);
+
+	const auto r = validateStreamDescriptor(sd);
+	if(LZ4MT_RESULT_OK != r) {
+		ctx->result = r;
+		return nullptr;
+	}
+	ctx->result = LZ4MT_RESULT_OK;
+	return new Lz4MtStream(ctx, sd);
+}
+
+
+extern "C" Lz4MtResult
+lz4mtStreamWrite(
+	  Lz4MtStream* stream
+	, const void* src
+	, size_t srcSize
+) {
+	assert(stream);
+
+	if(!src && srcSize) {
+		return LZ4MT_RESULT_BAD_ARG;
+	}
+	return stream->io.push(src, srcSize);
+}
+
+
+extern "C" Lz4MtResult
+lz4mtStreamFlush(
+	  Lz4MtStream* stream
+) {
+	assert(stream);
+
+	return stream->io.flush();
+}
+
+
+extern "C" Lz4MtResult
+lz4mtStreamEnd(
+	  Lz4MtStream* stream
+) {
+	assert(stream);
+
+	const auto r = stream->io.end();
+	delete stream;
+	return r;
+}
@@ -9,6 +9,10 @@ extern "C" {
 
 
 struct Lz4MtParam;
+struct Lz4MtDictionaries;
+struct Lz4MtStats;
+struct Lz4MtExecutor;
+struct Lz4MtStream;
 
 typedef int (*Lz4MtRead)(
 	  struct Lz4MtContext* ctx
@@ -37,6 +41,88 @@ typedef int (*Lz4MtWrite)(
 	, int srcSize
 );
 
+// Reads dstSize bytes at offset of the input, wherever the read position
+// is.  Used for random access, by lz4mtDecompressRange(), and by the
+// workers with LZ4MT_MODE_BLOCK_INDEX : it may be called from several
+// threads at once.
+typedef int (*Lz4MtReadAt)(
+	  struct Lz4MtContext* ctx
+	, void* dst
+	, int dstSize
+	, uint64_t offset
+);
+
+typedef uint64_t (*Lz4MtReadSize)(
+	  const struct Lz4MtContext* ctx
+);
+
+// Lends the next (up to) size bytes of the input instead of copying
+// them.  *ptr stays valid until the input is closed.
+typedef int (*Lz4MtReadView)(
+	  struct Lz4MtContext* ctx
+	, const void** ptr
+	, int size
+);
+
+// Gives back a span lent by readView() once the library is done with it.
+// Spans come back in the order they were lent.  When it is set, a span
+// only has to stay valid until it is released.
+typedef void (*Lz4MtReadRelease)(
+	  struct Lz4MtContext* ctx
+	, const void* ptr
+	, int size
+);
+
+// Appends size bytes to the output and returns where to store them, or
+// nullptr when the output cannot provide them (write() is used instead).
+typedef void* (*Lz4MtWriteReserve)(
+	  const struct Lz4MtContext* ctx
+	, uint64_t size
+);
+
+// Takes back the last size bytes writeReserve() appended, which the frame
+// ended without filling : the output ends after the stored bytes again.
+typedef void (*Lz4MtWriteUnreserve)(
+	  const struct Lz4MtContext* ctx
+	, uint64_t size
+);
+
+// Lends a buffer of at least size bytes to hold the next span of output,
+// or returns nullptr to have the library use write() for it.
+typedef void* (*Lz4MtWriteBorrow)(
+	  const struct Lz4MtContext* ctx
+	, int size
+);
+
+// Hands a buffer from writeBorrow() back with size bytes of output in it.
+// The caller owns the output from then on.  Buffers come back in stream
+// order, with size 0 when the library did not use them.  Returns the
+// number of bytes taken, like write().
+typedef int (*Lz4MtWriteReturn)(
+	  const struct Lz4MtContext* ctx
+	, void* ptr
+	, int size
+);
+
+// One span of a gathered write.
+struct Lz4MtSpan {
+	const void*	ptr;
+	int			size;
+};
+typedef struct Lz4MtSpan Lz4MtSpan;
+
+// Appends nSpan spans to the output in one go, like writev().  Called
+// instead of write() for runs of consecutive blocks.  Returns the number
+// of bytes taken, the sum of the sizes when all of them went out.
+typedef int (*Lz4MtWriteGather)(
+	  const struct Lz4MtContext* ctx
+	, const Lz4MtSpan* spans
+	, int nSpan
+);
+
+// The compression callbacks return the compressed size, 0 when it would
+// not fit in maxOutputSize (the block is stored raw), or a negative value
+// when they fail, which ends the stream with LZ4MT_RESULT_COMPRESS_FAIL.
 typedef int (*Lz4MtCompress)(
 	  const char* src
 	, char* dst
@@ -44,6 +130,61 @@ typedef int (*Lz4MtCompress)(
 	, int maxOutputSize
 );
 
+// Compression state owned by one worker thread, created on its first
+// block and reused for the following ones.  level : Lz4MtContext::level,
+// kept in the state for the compression functions which take one.
+typedef void* (*Lz4MtStateCreate)(
+	  int level
+);
+
+typedef void (*Lz4MtStateFree)(
+	  void* state
+);
+
+// Used instead of compress when stateCreate is set.  state : nullptr when
+// stateCreate failed.
+typedef int (*Lz4MtCompressWithState)(
+	  void* state
+	, const char* src
+	, char* dst
+	, int isize
+	, int maxOutputSize
+);
+
+// src is preceded by prefixSize (<= 64KB) bytes of history.
+// state : from stateCreate, nullptr when it is not set or failed.
+typedef int (*Lz4MtCompressWithPrefix)(
+	  void* state
+	, const char* src
+	, char* dst
+	, int prefixSize
+	, int isize
+	, int maxOutputSize
+);
+
+// Builds the compression state of a dictionary once, to be shared by
+// every block which starts with it.
+typedef void* (*Lz4MtDictionaryCreate)(
+	  const char* dict
+	, int dictSize
+);
+
+typedef void (*Lz4MtDictionaryFree)(
+	  void* dictState
+);
+
+// src is preceded by the dictSize bytes dictState was built from.
+// state : from stateCreate, nullptr when it is not set or failed.
+typedef int (*Lz4MtCompressWithDictionary)(
+	  void* state
+	, const void* dictState
+	, const char* src
+	, char* dst
+	, int dictSize
+	, int isize
+	, int maxOutputSize
+);
+
 typedef int (*Lz4MtCompressBound)(
 	  int isize
 );
@@ -55,11 +196,30 @@ typedef int (*Lz4MtDecompress)(
 	, int maxOutputSize
 );
 
+// Decodes exactly originalSize bytes, and returns the number of bytes read
+// from src or < 0.  Reads of src are not bounds checked.
+//
+// In LZ4MT_MODE_TRUSTED, blocks read into lz4mt's buffers are decoded as
+// the size they have when every block before them is full : the block
+// size, or what is left of streamSize.  A block which this does not
+// consume exactly is decoded again with decompress.  Valid frames are
+// safe to decode this way, corrupt ones are not : the mode is for frames
+// lz4mt wrote, with a stream checksum.
+typedef int (*Lz4MtDecompressFast)(
+	  const char* src
+	, char* dst
+	, int originalSize
+);
+
 
 enum Lz4MtMode {
 	  LZ4MT_MODE_DEFAULT		= 0
 	, LZ4MT_MODE_PARALLEL		= 0 << 0
 	, LZ4MT_MODE_SEQUENTIAL		= 1 << 0
+	, LZ4MT_MODE_HUGE_PAGES		= 1 << 1
+	, LZ4MT_MODE_SEEK_TABLE		= 1 << 2	// compress : append a seek table
+	, LZ4MT_MODE_BLOCK_INDEX	= 1 << 3	// decompress : workers readAt() their blocks
+	, LZ4MT_MODE_TRUSTED		= 1 << 4	// decompress : decompressFast, for frames lz4mt wrote
 };
 typedef enum Lz4MtMode Lz4MtMode;
 
@@ -85,6 +245,13 @@ enum Lz4MtResult {
 	, LZ4MT_RESULT_STREAM_CHECKSUM_MISMATCH
 	, LZ4MT_RESULT_DECOMPRESS_FAIL
 	, LZ4MT_RESULT_BAD_ARG
+	, LZ4MT_RESULT_DICTIONARY_NOT_FOUND
+	, LZ4MT_RESULT_STREAM_SIZE_MISMATCH
+	, LZ4MT_RESULT_OUTPUT_BUFFER_TOO_SMALL
+	, LZ4MT_RESULT_CANNOT_WRITE_SEEK_TABLE
+	, LZ4MT_RESULT_SEEK_TABLE_NOT_FOUND
+	, LZ4MT_RESULT_RANGE_OUT_OF_BOUNDS
+	, LZ4MT_RESULT_COMPRESS_FAIL
 };
 typedef enum Lz4MtResult Lz4MtResult;
 
@@ -109,11 +276,38 @@ struct Lz4MtBd {
 typedef struct Lz4MtBd Lz4MtBd;
 
 
+// Compression only, not stored in the stream.  Blocks whose sampled
+// order-0 entropy is high enough are stored raw without being compressed.
+// Storing raw starts once enterBlocks blocks in a row sample at or above
+// enterEntropy, and stops at the first block below leaveEntropy.
+struct Lz4MtProbe {
+	int		sampleSize;			// bytes sampled per block, 0 : no probe
+	int		enterEntropy;		// millibits per byte, [0, 8000]
+	int		leaveEntropy;		// millibits per byte, <= enterEntropy
+	int		enterBlocks;		// >= 1
+};
+typedef struct Lz4MtProbe Lz4MtProbe;
+
+
+// Compression only, not stored in the stream.  Slow stretches of the input
+// are read as blocks of at most blockMaximumSize instead, so that several
+// workers share them.  Splitting starts once the recent compression time
+// per byte reaches slowdown percent of the stream average, and stops when
+// it falls back to the average.  Needs more than one worker.
+struct Lz4MtSplit {
+	char	blockMaximumSize;	// [4, bd.blockMaximumSize), 0 : no split
+	int		slowdown;			// percent, > 100
+};
+typedef struct Lz4MtSplit Lz4MtSplit;
+
+
 struct Lz4MtStreamDescriptor {
 	Lz4MtFlg	flg;
 	Lz4MtBd		bd;
 	uint64_t	streamSize;
 	uint32_t	dictId;
+	Lz4MtProbe	probe;
+	Lz4MtSplit	split;
 };
 typedef struct Lz4MtStreamDescriptor Lz4MtStreamDescriptor;
 
@@ -125,21 +319,125 @@ struct Lz4MtContext {
 	Lz4MtReadSkippable	readSkippable;
 	Lz4MtReadSeek		readSeek;
 	Lz4MtReadEof		readEof;
+	Lz4MtReadView		readView;			// optional
+	Lz4MtReadRelease	readRelease;		// optional, with readView
+	Lz4MtReadAt			readAt;				// optional, random access
+	Lz4MtReadSize		readSize;			// required by readAt
 	void*				writeCtx;
 	Lz4MtWrite			write;
+	Lz4MtWriteReserve	writeReserve;		// optional
+	Lz4MtWriteUnreserve	writeUnreserve;		// optional, with writeReserve
+	Lz4MtWriteBorrow	writeBorrow;		// optional
+	Lz4MtWriteReturn	writeReturn;		// required by writeBorrow
+	Lz4MtWriteGather	writeGather;		// optional
 
 	Lz4MtCompress		compress;
 	Lz4MtCompressBound	compressBound;
 	Lz4MtDecompress		decompress;
+	Lz4MtStateCreate	stateCreate;
+	Lz4MtStateFree		stateFree;
+	Lz4MtCompressWithState	compressWithState;	// used instead of compress with stateCreate
+	Lz4MtCompressWithPrefix	compressWithPrefix;		// linked blocks
+	Lz4MtDecompress		decompressWithPrefix;	// linked blocks, dst is preceded by 64KB of history
+	Lz4MtDecompressFast	decompressFast;			// trusted mode
+	Lz4MtDecompressFast	decompressFastWithPrefix;	// trusted mode, linked blocks
+	Lz4MtDictionaryCreate	dictionaryCreate;
+	Lz4MtDictionaryFree		dictionaryFree;
+	Lz4MtCompressWithDictionary	compressWithDictionary;
+	struct Lz4MtDictionaries*	dictionaries;		// lz4mtAddDictionary()
+	int					level;				// given to stateCreate, 0 : default of the codec
+	int					adaptiveLevel;		// 0 : off, else blocks use it while I/O is the bottleneck
 	Lz4MtMode			mode;
+	unsigned			threadCount;		// 0 : hardware concurrency
+	unsigned			poolDepth;			// blocks in flight, 0 : threadCount + 1
+	uint64_t			affinityMask;		// bit i : workers may run on CPU i, 0 : any
+	struct Lz4MtExecutor*	executor;		// optional, shared workers and buffers
+	struct Lz4MtStats*	stats;				// optional, see Lz4MtStats
 };
 typedef struct Lz4MtContext Lz4MtContext;
 
 
+// Latencies of single blocks : count[i] blocks took [2^i, 2^(i+1))
+// nanoseconds, the last one counts every longer block as well.
+enum {
+	LZ4MT_HISTOGRAM_SIZE = 40
+};
+
+struct Lz4MtHistogram {
+	uint64_t	count[LZ4MT_HISTOGRAM_SIZE];
+};
+typedef struct Lz4MtHistogram Lz4MtHistogram;
+
+// Where the time of lz4mtCompress() and lz4mtDecompress() goes.  When
+// Lz4MtContext::stats is set, every call adds its counters to it when it
+// returns; calls running at the same time may share one struct.  Times
+// are summed over all threads, in nanoseconds.
+struct Lz4MtStats {
+	uint64_t	readNs;				// read callbacks
+	uint64_t	windowWaitNs;		// reader waiting for a free in-flight slot
+	uint64_t	allocWaitNs;		// waiting for an exhausted buffer pool
+	uint64_t	codecNs;			// compress and decompress callbacks
+	uint64_t	orderWaitNs;		// workers waiting for the previous block
+	uint64_t	writeNs;			// write callbacks
+	uint64_t	hashNs;				// block and stream checksums
+	uint64_t	blocks;
+	uint64_t	incompressibleBlocks;
+	uint64_t	allocStalls;		// buffer requests which had to wait
+	uint64_t	maxInFlight;		// most blocks between read and commit
+	uint64_t	bytesIn;
+	uint64_t	bytesOut;
+	uint64_t	adaptiveBlocks;		// compressed at Lz4MtContext::adaptiveLevel
+	Lz4MtHistogram	codedLatency;	// block read to compressed (or decoded)
+	Lz4MtHistogram	writtenLatency;	// compressed to written, in stream order
+	Lz4MtHistogram	blockedLatency;	// waiting for the preceding blocks
+};
+typedef struct Lz4MtStats Lz4MtStats;
+
+
 Lz4MtContext lz4mtInitContext();
 Lz4MtStreamDescriptor lz4mtInitStreamDescriptor();
+Lz4MtStats lz4mtInitStats();
+
+// Worker threads (0 : hardware concurrency) and block buffers shared by
+// the calls of every context which points to it, instead of each call
+// starting its own.  The streams take turns on the workers, and the
+// buffers of all of them stay under memoryLimit bytes (0 : no limit) : a
+// call waits for memory when it would go over, unless it is alone.
+// affinityMask replaces the one of the contexts.  Free it once no call
+// uses it any more.
+struct Lz4MtExecutor* lz4mtCreateExecutor(
+	  unsigned threadCount
+	, uint64_t memoryLimit
+	, uint64_t affinityMask
+);
+
+void lz4mtFreeExecutor(
+	  struct Lz4MtExecutor* executor
+);
+
+// Nanoseconds which the given percentile [0, 100] of the blocks took less
+// than : the upper end of its bucket, UINT64_MAX in the last bucket, or 0
+// when the histogram is empty.
+uint64_t lz4mtHistogramPercentile(
+	  const Lz4MtHistogram* histogram
+	, double percentile
+);
+
 const char* lz4mtResultToString(Lz4MtResult result);
 
+// Registers a preset dictionary (only its last 64KB are used).
+// Dictionaries are released by lz4mtFreeDictionaries().
+Lz4MtResult lz4mtAddDictionary(
+	  Lz4MtContext* ctx
+	, uint32_t dictId
+	, const void* dict
+	, int dictSize
+);
+
+void lz4mtFreeDictionaries(
+	  Lz4MtContext* ctx
+);
+
 Lz4MtResult lz4mtCompress(
 	  Lz4MtContext* ctx
 	, const Lz4MtStreamDescriptor* sd
@@ -150,6 +448,97 @@ Lz4MtResult lz4mtDecompress(
 	, Lz4MtStreamDescriptor* sd
 );
 
+// Largest frame lz4mtCompressBuffer() makes from srcSize bytes, or 0 when
+// sd is not valid.  With sd->split, every block is counted at the split
+// size.
+uint64_t lz4mtCompressFrameBound(
+	  const Lz4MtStreamDescriptor* sd
+	, uint64_t srcSize
+);
+
+// Largest seek table lz4mtCompress() appends to a frame of srcSize bytes
+// with LZ4MT_MODE_SEEK_TABLE, or 0 when sd is not valid.  With sd->split,
+// every block is counted at the split size.
+uint64_t lz4mtSeekTableBound(
+	  const Lz4MtStreamDescriptor* sd
+	, uint64_t srcSize
+);
+
+// Decompresses size bytes from offset of the content of the last frame of
+// the input, by way of its seek table.  Only the blocks holding the range
+// are read (all blocks up to it for linked blocks) through readAt().
+// sd receives the descriptor of the frame.
+//
+// The whole range has to be inside the content : offset + size greater
+// than its size is LZ4MT_RESULT_RANGE_OUT_OF_BOUNDS, and nothing is
+// written.  An empty range, up to offset == content size, writes nothing.
+Lz4MtResult lz4mtDecompressRange(
+	  Lz4MtContext* ctx
+	, Lz4MtStreamDescriptor* sd
+	, uint64_t offset
+	, uint64_t size
+);
+
+// Buffer to buffer versions of lz4mtCompress() and lz4mtDecompress().
+// The I/O callbacks of ctx are not used.  *dstSize receives the number
+// of bytes stored in dst.
+//
+// Compression makes a single frame.  When dstCapacity is at least
+// lz4mtCompressFrameBound(), blocks are compressed in place in dst and
+// compacted as they are committed.
+Lz4MtResult lz4mtCompressBuffer(
+	  Lz4MtContext* ctx
+	, const Lz4MtStreamDescriptor* sd
+	, const void* src
+	, size_t srcSize
+	, void* dst
+	, size_t dstCapacity
+	, size_t* dstSize
+);
+
+// Decompresses every frame of src.  sd receives the descriptor of the
+// last frame.
+Lz4MtResult lz4mtDecompressBuffer(
+	  Lz4MtContext* ctx
+	, Lz4MtStreamDescriptor* sd
+	, const void* src
+	, size_t srcSize
+	, void* dst
+	, size_t dstCapacity
+	, size_t* dstSize
+);
+
+// Compresses one frame from data pushed by lz4mtStreamWrite(), for
+// input which arrives over time.  Full blocks go to the workers as the
+// data comes in.  lz4mtStreamFlush() also sends the data of a partial
+// block, as a short block, and returns once the output has everything
+// pushed so far.  The frame stays open until lz4mtStreamEnd().
+//
+// Only the write() and writeGather() callbacks of ctx are used; they are
+// called from other threads.  ctx must stay valid until lz4mtStreamEnd(),
+// which frees the stream and stores the result in it.  Returns nullptr
+// when sd is not valid.  A stream is used from one thread at a time.
+struct Lz4MtStream* lz4mtStreamBegin(
+	  Lz4MtContext* ctx
+	, const Lz4MtStreamDescriptor* sd
+);
+
+// Waits while a block of data is pending.  Fails once the frame could
+// not be written.
+Lz4MtResult lz4mtStreamWrite(
+	  struct Lz4MtStream* stream
+	, const void* src
+	, size_t srcSize
+);
+
+Lz4MtResult lz4mtStreamFlush(
+	  struct Lz4MtStream* stream
+);
+
+Lz4MtResult lz4mtStreamEnd(
+	  struct Lz4MtStream* stream
+);
+
 
 #if defined (__cplusplus)
 }
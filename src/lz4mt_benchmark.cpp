@@ -1,41 +1,149 @@
+#include <algorithm>
 #include <cassert>
-#include <cfloat>
 #include <chrono>
-#include <future>
+#include <cmath>
 #include <functional>
 #include <iostream>
 #include <iomanip>
-#include <map>
 #include <numeric>
+#include <sstream>
 #include <string>
 #include <vector>
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
 #include "xxhash.h"
 #include "lz4mt.h"
 #include "lz4mt_benchmark.h"
+#include "lz4mt_compat.h"
+#include "test_clock.h"
 
 namespace {
 
-typedef std::chrono::high_resolution_clock Clock;
-typedef Clock::time_point TimePoint;
+double getTimeSpan(const Clock::time_point& tStart, const Clock::time_point& tEnd) {
+	return std::chrono::duration<double>(tEnd - tStart).count();
+}
 
-TimePoint getTime() {
-	return Clock::now();
+// Nearest rank, times are sorted.
+double percentile(const std::vector<double>& times, int p) {
+	assert(!times.empty());
+	const auto n = times.size();
+	auto rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(n)));
+	rank = std::max<size_t>(1, std::min(rank, n));
+	return times[rank - 1];
 }
 
-TimePoint getSyncTime() {
-	const auto t0 = getTime();
-	for(;;) {
-		const auto t = getTime();
-		if(t0 != t) {
-			return t;
+struct Timing {
+	Timing()
+		: times()
+		, efficiency(0.0)
+		, stats(lz4mtInitStats())
+	{}
+
+	double min() const {
+		return percentile(times, 0);
+	}
+
+	double median() const {
+		return percentile(times, 50);
+	}
+
+	double p90() const {
+		return percentile(times, 90);
+	}
+
+	std::vector<double>	times;		// seconds, sorted
+	double				efficiency;
+	Lz4MtStats			stats;		// Benchmark::stats only
+};
+
+// Block latencies reported with Benchmark::stats
+struct Latency {
+	const char*				name;
+	Lz4MtHistogram Lz4MtStats::*	histogram;
+};
+
+const Latency latencies[] = {
+	  { "coded",	&Lz4MtStats::codedLatency }
+	, { "written",	&Lz4MtStats::writtenLatency }
+	, { "blocked",	&Lz4MtStats::blockedLatency }
+};
+
+const int latencyPercentiles[] = { 50, 99 };
+
+double getLatencyMs(const Timing& t, const Latency& l, int p) {
+	return static_cast<double>(lz4mtHistogramPercentile(&(t.stats.*l.histogram), p)) / 1000000.0;
+}
+
+struct Result {
+	Result()
+		: filename()
+		, blockSize(0)
+		, threads(0)
+		, inpSize(0)
+		, cmpSize(0)
+		, compress()
+		, decompress()
+	{}
+
+	double ratio() const {
+		return inpSize ? static_cast<double>(cmpSize) / static_cast<double>(inpSize) : 0.0;
+	}
+
+	double mibs(const Timing& t) const {
+		const auto s = t.median();
+		return s > 0.0 ? static_cast<double>(inpSize) / 1024.0 / 1024.0 / s : 0.0;
+	}
+
+	std::string	filename;
+	int			blockSize;
+	unsigned	threads;
+	uint64_t	inpSize;
+	uint64_t	cmpSize;
+	Timing		compress;
+	Timing		decompress;
+};
+
+// Throughput per thread against the first configuration of the sweep.
+double getEfficiency(const Timing& base, unsigned baseThreads
+					 , const Timing& t, unsigned threads)
+{
+	const auto d = t.median() * threads;
+	return d > 0.0 ? base.median() * baseThreads / d : 0.0;
+}
+
+std::string csvString(const std::string& s) {
+	if(std::string::npos == s.find_first_of(",\"\n")) {
+		return s;
+	}
+	std::string r = "\"";
+	for(const auto c : s) {
+		if('"' == c) {
+			r += '"';
 		}
+		r += c;
 	}
+	return r + "\"";
 }
 
-double getTimeSpan(const TimePoint& tStart, const TimePoint& tEnd) {
-	using namespace std::chrono;
-	const auto dt = duration_cast<seconds>(tEnd - tStart).count();
-	return static_cast<double>(dt);
+std::string jsonString(const std::string& s) {
+	std::ostringstream o;
+	o << '"';
+	for(const auto c : s) {
+		const auto u = static_cast<unsigned char>(c);
+		if('"' == c || '\\' == c) {
+			o << '\\' << c;
+		} else if(u < 0x20) {
+			o << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+			  << static_cast<unsigned>(u) << std::dec;
+		} else {
+			o << c;
+		}
+	}
+	o << '"';
+	return o.str();
 }
 
 } // anonymous namespace
@@ -47,6 +155,10 @@ Benchmark::Benchmark()
 	: enable(false)
 	, nIter(3)
 	, files()
+	, threadCounts()
+	, blockSizes()
+	, format(Format::TEXT)
+	, stats(false)
 	, openIstream()
 	, closeIstream()
 	, getFilesize()
@@ -60,15 +172,12 @@ int Benchmark::measure(
 	, const Lz4MtStreamDescriptor& sd
 ) {
 	auto& logger = std::cerr;
+	auto& out = std::cout;
 
 	const auto msgClearLine = [&logger] {
 		logger << "\r" << std::setw(79) << " " << "\r";
 	};
 
-	const auto msgNewline = [&logger] {
-		logger << std::endl;
-	};
-
 	const auto msgErrOpening = [&logger](const std::string& filename) {
 		logger << "Error: problem opening " << filename << std::endl;
 	};
@@ -83,6 +192,14 @@ int Benchmark::measure(
 			 << "Error: problem reading file " << filename << std::endl;
 	};
 
+	const auto msgErrResult = [&logger]
+		(const std::string& filename, Lz4MtResult e)
+	{
+		logger << std::endl
+			 << "Error: " << filename << " : " << lz4mtResultToString(e)
+			 << std::endl;
+	};
+
 	const auto msgErrChecksum = [&logger]
 		(const std::string& filename, uint32_t inpHash, uint32_t outHash)
 	{
@@ -94,54 +211,206 @@ int Benchmark::measure(
 			 << std::setw(8) << inpHash
 			 << " != "
 			 << std::setw(8) << outHash
+			 << std::setfill(' ') << std::dec
 			 << std::endl;
 	};
 
-	const auto msgReport = [&logger]
-		(  const std::string& filename
-		 , int iLoop
-		 , size_t filesize
-		 , size_t cmpSize
-		 , double minCompressionTime
-		 , double minDecompressionTime
-		)
+	const auto msgProgress = [&logger]
+		(const std::string& filename, int blockSize, unsigned threads, int iLoop)
 	{
-		logger << iLoop << '-'
-			 << std::setw(14) << std::left << filename
-			 << " :"
-			 << std::setw(10) << std::right << filesize
-			 << " ->"
-			 << std::setw(10) << cmpSize;
-
-		const auto dFilesize = static_cast<double>(filesize);
-		const auto dFilesizeMib = dFilesize / 1024.0 / 1024.0;
-
-		logger.precision(2);
-		logger << std::fixed
-			<< " ("
-			<< std::setw(6)
-			<< static_cast<double>(cmpSize) * 100.0 / dFilesize
-			<< "%),";
-
-		logger.precision(1);
-		logger
-			<< std::setw(7)
-			<< dFilesizeMib / minCompressionTime << " MiB/s, "
-			<< std::setw(7)
-			<< dFilesizeMib / minDecompressionTime << " MiB/s"
-			<< "\r";
-
+		logger << "B" << blockSize << " T" << threads << " "
+			 << filename << " : " << iLoop << "\r";
 		logger.flush();
 	};
 
+	bool firstRow = true;
+
+	const auto msgHeader = [&] {
+		switch(format) {
+		case Format::TEXT:
+			logger << std::setw(14) << std::left << "file" << std::right
+				 << "  B   T      input ratio%"
+				 << " | comp min    p50    p90 ms   MiB/s  eff%"
+				 << " | dec min    p50    p90 ms   MiB/s  eff%"
+				 << std::endl;
+			if(stats) {
+				logger << std::setw(14) << "" << "  block latency p50/p99 ms :"
+					 << " coded, written, blocked"
+					 << std::endl;
+			}
+			break;
+		case Format::CSV:
+			out << "file,block,threads,iterations,input_bytes,compressed_bytes,ratio"
+				<< ",compress_min_ms,compress_p50_ms,compress_p90_ms"
+				<< ",compress_mib_s,compress_efficiency"
+				<< ",decompress_min_ms,decompress_p50_ms,decompress_p90_ms"
+				<< ",decompress_mib_s,decompress_efficiency";
+			if(stats) {
+				const char* const ops[] = { "compress", "decompress" };
+				for(const auto* op : ops) {
+					for(const auto& l : latencies) {
+						for(const auto p : latencyPercentiles) {
+							out << "," << op << "_" << l.name << "_p" << p << "_ms";
+						}
+					}
+				}
+			}
+			out << std::endl;
+			break;
+		case Format::JSON:
+			out << "[";
+			break;
+		}
+	};
+
+	const auto msgReport = [&](const Result& r) {
+		const auto ms = [](double s) {
+			return s * 1000.0;
+		};
+		switch(format) {
+		case Format::TEXT: {
+			const auto timing = [&](const Timing& t) {
+				logger << std::setw(8) << ms(t.min())
+					 << std::setw(7) << ms(t.median())
+					 << std::setw(7) << ms(t.p90())
+					 << std::setw(11) << r.mibs(t)
+					 << std::setw(6) << t.efficiency * 100.0;
+			};
+			msgClearLine();
+			logger << std::fixed << std::setprecision(1)
+				 << std::setw(14) << std::left << r.filename << std::right
+				 << std::setw(3) << r.blockSize
+				 << std::setw(4) << r.threads
+				 << std::setw(11) << r.inpSize
+				 << std::setw(7) << r.ratio() * 100.0
+				 << " |";
+			timing(r.compress);
+			logger << " |";
+			timing(r.decompress);
+			logger << std::endl;
+			if(stats) {
+				const auto latency = [&](const Timing& t) {
+					logger.precision(3);
+					for(const auto& l : latencies) {
+						logger << (&l != latencies ? ", " : "");
+						for(const auto p : latencyPercentiles) {
+							logger << (p != latencyPercentiles[0] ? "/" : "")
+								 << getLatencyMs(t, l, p);
+						}
+					}
+				};
+				logger << std::setw(14) << "" << "  comp ";
+				latency(r.compress);
+				logger << " | dec ";
+				latency(r.decompress);
+				logger << std::endl;
+			}
+			break;
+		}
+		case Format::CSV: {
+			const auto timing = [&](const Timing& t) {
+				out << "," << ms(t.min())
+					<< "," << ms(t.median())
+					<< "," << ms(t.p90())
+					<< "," << r.mibs(t)
+					<< "," << t.efficiency;
+			};
+			out << std::fixed << std::setprecision(6)
+				<< csvString(r.filename)
+				<< "," << r.blockSize
+				<< "," << r.threads
+				<< "," << r.compress.times.size()
+				<< "," << r.inpSize
+				<< "," << r.cmpSize
+				<< "," << r.ratio();
+			timing(r.compress);
+			timing(r.decompress);
+			if(stats) {
+				const Timing* const ts[] = { &r.compress, &r.decompress };
+				for(const auto* t : ts) {
+					for(const auto& l : latencies) {
+						for(const auto p : latencyPercentiles) {
+							out << "," << getLatencyMs(*t, l, p);
+						}
+					}
+				}
+			}
+			out << std::endl;
+			break;
+		}
+		case Format::JSON: {
+			const auto timing = [&](const char* name, const Timing& t) {
+				out << ", \"" << name << "\": {"
+					<< "\"min_ms\": " << ms(t.min())
+					<< ", \"p50_ms\": " << ms(t.median())
+					<< ", \"p90_ms\": " << ms(t.p90())
+					<< ", \"mib_s\": " << r.mibs(t)
+					<< ", \"efficiency\": " << t.efficiency
+					<< ", \"times_ms\": [";
+				for(const auto& s : t.times) {
+					out << (&s != t.times.data() ? ", " : "") << ms(s);
+				}
+				out << "]";
+				if(stats) {
+					out << ", \"latency_ms\": {";
+					for(const auto& l : latencies) {
+						out << (&l != latencies ? ", " : "")
+							<< "\"" << l.name << "\": {";
+						for(const auto p : latencyPercentiles) {
+							out << (p != latencyPercentiles[0] ? ", " : "")
+								<< "\"p" << p << "\": " << getLatencyMs(t, l, p);
+						}
+						out << "}";
+					}
+					out << "}";
+				}
+				out << "}";
+			};
+			out << std::fixed << std::setprecision(6)
+				<< (firstRow ? "\n" : ",\n")
+				<< "{\"file\": " << jsonString(r.filename)
+				<< ", \"block\": " << r.blockSize
+				<< ", \"threads\": " << r.threads
+				<< ", \"iterations\": " << r.compress.times.size()
+				<< ", \"input_bytes\": " << r.inpSize
+				<< ", \"compressed_bytes\": " << r.cmpSize
+				<< ", \"ratio\": " << r.ratio();
+			timing("compress", r.compress);
+			timing("decompress", r.decompress);
+			out << "}";
+			out.flush();
+			break;
+		}
+		}
+		firstRow = false;
+	};
+
+	const auto msgFooter = [&] {
+		if(Format::JSON == format) {
+			out << "\n]" << std::endl;
+		}
+	};
+
 	auto* ctx = &cx;
 	const bool singleThread = 0 != (ctx->mode & LZ4MT_MODE_SEQUENTIAL);
-	size_t totalFileSize = 0;
-	size_t totalCompressSize = 0;
-	double totalCompressTime = 0.0;
-	double totalDecompressTime = 0.0;
-	const auto TIMELOOP = 2.0;	// sec
 
+	// Threads which run the codec in a configuration.
+	const auto getThreads = [](const Lz4MtContext& c) -> unsigned {
+		if(0 != (c.mode & LZ4MT_MODE_SEQUENTIAL)) {
+			return 1;
+		} else if(c.threadCount) {
+			return c.threadCount;
+		} else {
+			return std::max(1u, getHardwareConcurrency());
+		}
+	};
+
+	std::vector<int> bss = blockSizes;
+	if(bss.empty()) {
+		bss.push_back(sd.bd.blockMaximumSize);
+	}
+
+	msgHeader();
 	for(const auto& filename : files) {
 		std::vector<char> inpBuf(
 			static_cast<size_t>(getFilesize(filename))
@@ -153,7 +422,9 @@ int Benchmark::measure(
 				return 11;
 			}
 
-			msgLoading(filename);
+			if(Format::TEXT == format) {
+				msgLoading(filename);
+			}
 			const size_t readSize = ctx->read(ctx, inpBuf.data()
 									  , static_cast<int>(inpBuf.size()));
 			closeIstream(ctx);
@@ -163,142 +434,110 @@ int Benchmark::measure(
 				return 13;
 			}
 		}
-		msgClearLine();
+		if(Format::TEXT == format) {
+			msgClearLine();
+		}
 
 		const auto inpHash =
 			XXH32(inpBuf.data(), static_cast<int>(inpBuf.size()), 0);
-		const auto chunkSize =
-				(size_t(1) << (8 + (2 * sd.bd.blockMaximumSize)));
-		const auto nChunk		= (inpBuf.size() / chunkSize) + 1;
-		const auto maxChunkSize	=
-			static_cast<size_t>(
-				ctx->compressBound(static_cast<int>(chunkSize)));
-
-		std::vector<char> outBuf(nChunk * maxChunkSize);
-
-		struct Chunk {
-			int		id;
-			char*	inpPtr;
-			size_t	inpSize;
-			char*	outPtr;
-			size_t	outSize;
-			size_t	cmpSize;
-			size_t	decSize;
-		};
 
-		std::vector<Chunk> chunks(nChunk);
-		{
-			auto r = inpBuf.size();
-			for(auto& e : chunks) {
-				const auto i = static_cast<int>(&e - chunks.data());
-				e.id		= i;
-				e.inpPtr	= &inpBuf[i * chunkSize];
-				e.inpSize	= r > chunkSize ? chunkSize : r;
-				e.outPtr	= &outBuf[i * maxChunkSize];
-				e.outSize	= maxChunkSize;
-				e.cmpSize	= 0;
-				e.decSize	= 0;
-				r -= e.inpSize;
+		for(const auto bs : bss) {
+			auto bsd = sd;
+			bsd.bd.blockMaximumSize = static_cast<char>(bs);
+			bsd.flg.streamSize = 0;
+			bsd.streamSize = 0;
+
+			std::vector<char> cmpBuf(static_cast<size_t>(
+				lz4mtCompressFrameBound(&bsd, inpBuf.size())));
+			std::vector<char> decBuf(inpBuf.size());
+			if(cmpBuf.empty()) {
+				msgErrResult(filename, LZ4MT_RESULT_INVALID_BLOCK_MAXIMUM_SIZE);
+				return 14;
 			}
-		}
-
-		std::vector<std::future<void>> futures(chunks.size());
-
-		const auto b = [=, &futures, &chunks]
-			(std::function<void(Chunk*)> fChunk) -> double
-		{
-			const auto t0 = getSyncTime();
-			auto t1 = t0;
-			int loopCount = 0;
 
-			while(getTimeSpan(t0, t1 = getTime()) < TIMELOOP) {
-				for(auto& e : chunks) {
-					futures[e.id] = async(std::launch::async, fChunk, &e);
-				}
-				for(auto& e : futures) {
-					e.wait();
-				}
-				++loopCount;
+			std::vector<unsigned> tcs = threadCounts;
+			if(tcs.empty()) {
+				tcs.push_back(singleThread ? 1 : ctx->threadCount);
 			}
 
-			return getTimeSpan(t0, t1) / static_cast<double>(loopCount);
-		};
+			Result base;
+			for(const auto tc : tcs) {
+				auto c = cx;
+				if(!threadCounts.empty()) {
+					c.mode = static_cast<Lz4MtMode>(c.mode & ~LZ4MT_MODE_SEQUENTIAL);
+					c.threadCount = tc;
+				}
 
-		auto minCmpTime = DBL_MAX;
-		auto minDecTime = DBL_MAX;
-		size_t cmpSize = 0;
-		for(int iLoop = 1, nLoop = nIter; iLoop <= nLoop; ++iLoop) {
-			msgReport(filename, iLoop, inpBuf.size()
-					  , cmpSize, minCmpTime, minDecTime);
-
-			// compression
-			iota(outBuf.begin(), outBuf.end(), 0);
-			const auto cmpTime = b(
-				[ctx, singleThread, &futures] (Chunk* cp) {
-					if(singleThread && cp->id > 0) {
-						futures[cp->id-1].wait();
+				Result r;
+				r.filename	= filename;
+				r.blockSize	= bs;
+				r.threads	= getThreads(c);
+				r.inpSize	= inpBuf.size();
+
+				size_t cmpSize = 0;
+				size_t decSize = 0;
+				const auto compress = [&]() {
+					return lz4mtCompressBuffer(&c, &bsd
+						, inpBuf.data(), inpBuf.size()
+						, cmpBuf.data(), cmpBuf.size(), &cmpSize);
+				};
+				const auto decompress = [&]() {
+					auto dsd = lz4mtInitStreamDescriptor();
+					return lz4mtDecompressBuffer(&c, &dsd
+						, cmpBuf.data(), cmpSize
+						, decBuf.data(), decBuf.size(), &decSize);
+				};
+				const auto timed = [&c, this](const std::function<Lz4MtResult()>& f
+									  , Timing& t)
+				{
+					c.stats = stats ? &t.stats : nullptr;
+					const auto t0 = Clock::now();
+					const auto e = f();
+					t.times.push_back(getTimeSpan(t0, Clock::now()));
+					c.stats = nullptr;
+					return e;
+				};
+
+				// Warm up : page in the buffers and make the frame.
+				c.stats = nullptr;
+				auto e = compress();
+				const auto nLoop = std::max(1, nIter);
+				for(int iLoop = 1; LZ4MT_RESULT_OK == e && iLoop <= nLoop; ++iLoop) {
+					if(Format::TEXT == format) {
+						msgProgress(filename, bs, r.threads, iLoop);
+					}
+					e = timed(compress, r.compress);
+					if(LZ4MT_RESULT_OK == e) {
+						e = timed(decompress, r.decompress);
 					}
-					cp->cmpSize = ctx->compress(
-						  cp->inpPtr
-						, cp->outPtr
-						, static_cast<int>(cp->inpSize)
-						, static_cast<int>(cp->outSize)
-					);
 				}
-			);
-			minCmpTime = std::min(minCmpTime, cmpTime);
-
-			if(1 == iLoop) {
-				cmpSize = 0;
-				for(const auto& c : chunks) {
-					cmpSize += c.cmpSize;
+				if(LZ4MT_RESULT_OK != e) {
+					msgErrResult(filename, e);
+					return 14;
 				}
-			}
-
-			msgReport(filename, iLoop, inpBuf.size()
-					  , cmpSize, minCmpTime, minDecTime);
 
-			// decompression
-			fill(inpBuf.begin(), inpBuf.end(), 0);
-			const auto decTime = b(
-				[ctx, singleThread, &futures] (Chunk* cp) {
-					if(singleThread && cp->id > 0) {
-						futures[cp->id-1].wait();
-					}
-					cp->decSize = ctx->decompress(
-						  cp->outPtr
-						, cp->inpPtr
-						, static_cast<int>(cp->cmpSize)
-						, static_cast<int>(cp->inpSize)
-					);
+				const auto outHash =
+					XXH32(decBuf.data(), static_cast<int>(decSize), 0);
+				if(inpBuf.size() != decSize || inpHash != outHash) {
+					msgErrChecksum(filename, inpHash, outHash);
+					return 15;
 				}
-			);
-			minDecTime = std::min(minDecTime, decTime);
-
-			msgReport(filename, iLoop, inpBuf.size()
-					  , cmpSize, minCmpTime, minDecTime);
 
-			const auto outHash =
-				XXH32(inpBuf.data(), static_cast<int>(inpBuf.size()), 0);
-
-			if(inpHash != outHash) {
-				msgErrChecksum(filename, inpHash, outHash);
-				break;
+				r.cmpSize = cmpSize;
+				std::sort(r.compress.times.begin(), r.compress.times.end());
+				std::sort(r.decompress.times.begin(), r.decompress.times.end());
+				if(0 == base.threads) {
+					base = r;
+				}
+				r.compress.efficiency = getEfficiency(
+					base.compress, base.threads, r.compress, r.threads);
+				r.decompress.efficiency = getEfficiency(
+					base.decompress, base.threads, r.decompress, r.threads);
+				msgReport(r);
 			}
 		}
-		msgNewline();
-
-		totalFileSize += inpBuf.size();
-		totalCompressSize += cmpSize;
-		totalCompressTime += minCmpTime;
-		totalDecompressTime += minDecTime;
-	}
-
-	if(!files.empty()) {
-		msgReport("  TOTAL", 0, totalFileSize, totalCompressSize
-				  , totalCompressTime, totalDecompressTime);
-		msgNewline();
 	}
+	msgFooter();
 
 	return 0;
 }
@@ -8,8 +8,23 @@
 
 namespace Lz4Mt {
 
+///	Times lz4mtCompressBuffer() and lz4mtDecompressBuffer() on whole files
+///	held in memory, nIter times for every block size and thread count.
+///
+///	Each configuration reports the minimum, median and 90th percentile of
+///	its iterations, and the scaling efficiency of its median against the
+///	first thread count of the sweep : 100% means throughput grew with the
+///	thread count.  With stats, the timed iterations also collect
+///	Lz4MtStats, and the p50 and p99 block latencies are reported.  TEXT
+///	goes to std::cerr, CSV and JSON to std::cout.
 class Benchmark {
 public:
+	enum class Format {
+		  TEXT
+		, CSV
+		, JSON
+	};
+
 	Benchmark();
 	~Benchmark();
 	int measure(Lz4MtContext& ctx, const Lz4MtStreamDescriptor& sd);
@@ -17,6 +32,10 @@ public:
 	bool						enable;
 	int							nIter;
 	std::vector<std::string>	files;
+	std::vector<unsigned>		threadCounts;	// empty : as ctx, 0 : hardware concurrency
+	std::vector<int>			blockSizes;		// [4,7], empty : as sd
+	Format						format;
+	bool						stats;
 	std::function<bool (Lz4MtContext* ctx, const std::string& filename)> openIstream;
 	std::function<void (Lz4MtContext* ctx)> closeIstream;
 	std::function<uint64_t (const std::string& fileanme)> getFilesize;
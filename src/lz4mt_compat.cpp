@@ -1,33 +1,29 @@
 #include <cassert>
-#include <future>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #if defined(__GLIBC__)
 #include <sys/sysinfo.h> // get_nprocs()
 #endif
 
+#if defined(__linux__)
+#include <sched.h> // sched_getcpu()
+#endif
+
 #if defined(__APPLE__) || defined(__FreeBSD__)
 #include <sys/types.h>
 #include <sys/sysctl.h>
 #endif
-#include "lz4mt_compat.h"
 
-
-#ifndef GCC_VERSION
-#  if defined(__GNUC__) && defined(__GNUC_MINOR__) && !defined(__clang__)
-#    define GCC_VERSION (__GNUC__ * 100 + __GNUC_MINOR__)
-#  else
-#    define GCC_VERSION 0
-#  endif
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #endif
-
-#if (GCC_VERSION <= 406) && (GCC_VERSION > 0)
-#  define LAUNCH_SINGLE_THREAD std::launch::sync
-#else
-#  define LAUNCH_SINGLE_THREAD std::launch::deferred
-#endif // defined(__GNUC__)
-
-const decltype(Lz4Mt::launch::deferred) Lz4Mt::launch::deferred = LAUNCH_SINGLE_THREAD;
-const decltype(Lz4Mt::launch::async)    Lz4Mt::launch::async    = std::launch::async;
+#include "lz4mt_compat.h"
 
 
 unsigned Lz4Mt::getHardwareConcurrency() {
@@ -60,3 +56,96 @@ unsigned Lz4Mt::getHardwareConcurrency() {
 	assert(0);
 	return 8;
 }
+
+
+#if defined(__linux__)
+namespace {
+
+// cpu -> node map, read once from /sys/devices/system/node/node*/cpulist
+struct NumaTopology {
+	NumaTopology()
+		: nNode(1)
+		, cpuToNode()
+	{
+		for(unsigned node = 0; ; ++node) {
+			std::ostringstream path;
+			path << "/sys/devices/system/node/node" << node << "/cpulist";
+			std::ifstream ifs(path.str().c_str());
+			if(!ifs) {
+				break;
+			}
+			nNode = node + 1;
+
+			// cpulist : "0-3,8-11"
+			std::string range;
+			while(std::getline(ifs, range, ',')) {
+				unsigned first = 0;
+				unsigned last = 0;
+				char dash = 0;
+				std::istringstream iss(range);
+				if(!(iss >> first)) {
+					continue;
+				}
+				last = (iss >> dash >> last) ? last : first;
+				for(unsigned cpu = first; cpu <= last; ++cpu) {
+					if(cpuToNode.size() <= cpu) {
+						cpuToNode.resize(cpu + 1, 0);
+					}
+					cpuToNode[cpu] = node;
+				}
+			}
+		}
+	}
+
+	unsigned nNode;
+	std::vector<unsigned> cpuToNode;
+};
+
+const NumaTopology& getNumaTopology() {
+	static const NumaTopology t;
+	return t;
+}
+
+} // anonymous namespace
+#endif
+
+
+unsigned Lz4Mt::getNumaNodeCount() {
+#if defined(__linux__)
+	return getNumaTopology().nNode;
+#else
+	return 1;
+#endif
+}
+
+
+unsigned Lz4Mt::getCurrentNumaNode() {
+#if defined(__linux__)
+	const auto& t = getNumaTopology();
+	const auto cpu = sched_getcpu();
+	if(cpu >= 0 && static_cast<size_t>(cpu) < t.cpuToNode.size()) {
+		return t.cpuToNode[cpu];
+	}
+#endif
+	return 0;
+}
+
+
+bool Lz4Mt::setCurrentThreadAffinity(uint64_t mask) {
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(unsigned cpu = 0; cpu < 64; ++cpu) {
+		if(mask & (uint64_t(1) << cpu)) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	return 0 == sched_setaffinity(0, sizeof(set), &set);
+#elif defined(_WIN32)
+	return 0 != SetThreadAffinityMask(GetCurrentThread()
+									  , static_cast<DWORD_PTR>(mask));
+#else
+	(void) mask;
+	return false;
+#endif
+}
@@ -1,19 +1,17 @@
 #ifndef LZ4MT_COMPAT_H
 #define LZ4MT_COMPAT_H
 
+#include <cstdint>
+
 namespace Lz4Mt {
 
 unsigned getHardwareConcurrency();
+unsigned getNumaNodeCount();
+unsigned getCurrentNumaNode();
 
-struct launch {
-#if defined(_MSC_VER) && (_MSC_VER <= 1700)
-	typedef std::launch::launch Type;
-#else
-	typedef std::launch Type;
-#endif
-	static const Type deferred;
-	static const Type async;
-};
+// Binds the calling thread to the CPUs of mask (bit i : CPU i).
+// Returns false when the system does not allow it.
+bool setCurrentThreadAffinity(uint64_t mask);
 
 }
 
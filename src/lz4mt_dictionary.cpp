@@ -0,0 +1,54 @@
+#include "lz4mt_dictionary.h"
+
+
+namespace Lz4Mt {
+
+Dictionary::Dictionary(const void* dict, int dictSize)
+	: buf(static_cast<const char*>(dict), static_cast<const char*>(dict) + dictSize)
+	, mut()
+	, st(nullptr)
+	, stCreate(nullptr)
+	, stFree(nullptr)
+{
+}
+
+
+Dictionary::~Dictionary() {
+	releaseState();
+}
+
+
+const char* Dictionary::data() const {
+	return buf.data();
+}
+
+
+int Dictionary::size() const {
+	return static_cast<int>(buf.size());
+}
+
+
+const void* Dictionary::state(Lz4MtDictionaryCreate create, Lz4MtDictionaryFree free) {
+	std::unique_lock<std::mutex> lock(mut);
+	if(stCreate != create || stFree != free) {
+		releaseState();
+		if(create) {
+			st = create(buf.data(), size());
+			stCreate = create;
+			stFree = free;
+		}
+	}
+	return st;
+}
+
+
+void Dictionary::releaseState() {
+	if(st && stFree) {
+		stFree(st);
+	}
+	st = nullptr;
+	stCreate = nullptr;
+	stFree = nullptr;
+}
+
+} // namespace Lz4Mt
@@ -0,0 +1,52 @@
+#ifndef LZ4MT_DICTIONARY_H
+#define LZ4MT_DICTIONARY_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "lz4mt.h"
+
+namespace Lz4Mt {
+
+///	Preset dictionary and its prepared compression state.
+///
+///	The state is built by the first state() call, and kept until it is
+///	asked for with other callbacks.  state() is synchronized, so that
+///	concurrent lz4mtCompress() calls with the same callbacks may share
+///	one set of dictionaries; the workers of a call only read the state
+///	it returned.
+class Dictionary {
+public:
+	Dictionary(const void* dict, int dictSize);
+	~Dictionary();
+	const char* data() const;
+	int size() const;
+	const void* state(Lz4MtDictionaryCreate create, Lz4MtDictionaryFree free);
+
+private:
+	Dictionary(const Dictionary&);
+	const Dictionary& operator=(const Dictionary&);
+
+	void releaseState();
+
+	std::vector<char> buf;
+	std::mutex mut;
+	void* st;
+	Lz4MtDictionaryCreate stCreate;
+	Lz4MtDictionaryFree stFree;
+};
+
+} // namespace Lz4Mt
+
+
+struct Lz4MtDictionaries {
+	Lz4MtDictionaries()
+		: dicts()
+	{}
+
+	std::map<uint32_t, std::unique_ptr<Lz4Mt::Dictionary>> dicts;
+};
+
+#endif // LZ4MT_DICTIONARY_H
@@ -0,0 +1,264 @@
+#include <cassert>
+#include <mutex>
+#include <vector>
+#include "lz4mt_compat.h"
+#include "lz4mt_executor.h"
+
+namespace {
+
+uint64_t getBytes(const Lz4Mt::Executor::Shape& s) {
+	return static_cast<uint64_t>(s.elementSize) * s.elementCount;
+}
+
+bool isSameShape(const Lz4Mt::Executor::Shape& a, const Lz4Mt::Executor::Shape& b) {
+	return a.elementSize			== b.elementSize
+		&& a.elementCount			== b.elementCount
+		&& a.policy.alignment		== b.policy.alignment
+		&& a.policy.zeroFill		== b.policy.zeroFill
+		&& a.policy.hugePages		== b.policy.hugePages
+		&& a.policy.numaNodes		== b.policy.numaNodes;
+}
+
+} // anonymous namespace
+
+
+namespace Lz4Mt {
+
+Executor::Executor(unsigned nThread, uint64_t memoryLimit, uint64_t affinityMask)
+	: stop(false)
+	, mut()
+	, condWork()
+	, readyQueues()
+	, threads()
+	, memMut()
+	, memCond()
+	, memoryLimit(memoryLimit)
+	, memoryUsed(0)
+	, leases(0)
+	, idle()
+{
+	threads.reserve(nThread);
+	for(unsigned i = 0; i < nThread; ++i) {
+		threads.emplace_back(&Executor::worker, this, i, affinityMask);
+	}
+}
+
+
+Executor::~Executor() {
+	{
+		Lock lock(mut);
+		assert(readyQueues.empty());
+		stop = true;
+	}
+	condWork.notify_all();
+	for(auto& t : threads) {
+		t.join();
+	}
+}
+
+
+unsigned Executor::size() const {
+	return static_cast<unsigned>(threads.size());
+}
+
+
+void Executor::worker(unsigned index, uint64_t affinityMask) {
+	if(affinityMask) {
+		setCurrentThreadAffinity(affinityMask);
+	}
+	for(;;) {
+		Queue* q = nullptr;
+		Task task;
+		{
+			Lock lock(mut);
+			while(!stop && readyQueues.empty()) {
+				condWork.wait(lock);
+			}
+			if(readyQueues.empty()) {
+				return;
+			}
+			// the queue goes to the back of the line
+			q = readyQueues.front();
+			readyQueues.pop_front();
+			task = std::move(q->tasks.front());
+			q->tasks.pop_front();
+			++q->running;
+			if(q->tasks.empty()) {
+				q->ready = false;
+			} else {
+				readyQueues.push_back(q);
+			}
+		}
+		q->cond.notify_all();
+		task(index);
+		task = nullptr;
+		{
+			// q may be gone as soon as the lock is released
+			Lock lock(mut);
+			--q->running;
+			q->cond.notify_all();
+		}
+	}
+}
+
+
+void Executor::acquire(const std::vector<Shape>& shapes
+					   , std::vector<std::unique_ptr<MemPool>>& pools)
+{
+	pools.resize(shapes.size());
+	uint64_t need = 0;
+	std::deque<Idle> drop;
+	{
+		Lock lock(memMut);
+		for(;;) {
+			need = 0;
+			for(size_t i = 0; i < shapes.size(); ++i) {
+				if(pools[i]) {
+					continue;
+				}
+				auto it = idle.rbegin();
+				while(idle.rend() != it && !isSameShape(it->shape, shapes[i])) {
+					++it;
+				}
+				if(idle.rend() != it) {
+					pools[i] = std::move(it->pool);
+					idle.erase(std::next(it).base());
+				} else {
+					need += getBytes(shapes[i]);
+				}
+			}
+			while(memoryLimit && memoryUsed + need > memoryLimit && !idle.empty()) {
+				memoryUsed -= getBytes(idle.front().shape);
+				drop.push_back(std::move(idle.front()));
+				idle.pop_front();
+			}
+			if(!memoryLimit || memoryUsed + need <= memoryLimit || 0 == leases) {
+				break;
+			}
+			memCond.wait(lock);
+		}
+		memoryUsed += need;
+		++leases;
+	}
+	drop.clear();
+
+	for(size_t i = 0; i < shapes.size(); ++i) {
+		if(!pools[i]) {
+			const auto& s = shapes[i];
+			pools[i].reset(new MemPool(s.elementSize, s.elementCount, s.policy));
+		}
+	}
+}
+
+
+void Executor::release(const std::vector<Shape>& shapes
+					   , std::vector<std::unique_ptr<MemPool>>& pools)
+{
+	// Without a limit, as many idle pools as a stream per worker needs.
+	const auto maxIdle = 2 * (threads.size() + 1);
+	std::deque<Idle> drop;
+	{
+		Lock lock(memMut);
+		for(size_t i = 0; i < shapes.size(); ++i) {
+			Idle e = { shapes[i], std::move(pools[i]) };
+			idle.push_back(std::move(e));
+		}
+		while(!memoryLimit && idle.size() > maxIdle) {
+			memoryUsed -= getBytes(idle.front().shape);
+			drop.push_back(std::move(idle.front()));
+			idle.pop_front();
+		}
+		--leases;
+	}
+	memCond.notify_all();
+}
+
+
+Executor::Queue::Queue(Executor* executor, size_t capacity
+					   , unsigned nThread, uint64_t affinityMask)
+	: executor(executor)
+	, pool(executor ? nullptr : new ThreadPool(nThread, capacity, affinityMask))
+	, capacity(capacity ? capacity : 1)
+	, tasks()
+	, running(0)
+	, ready(false)
+	, cond()
+{}
+
+
+Executor::Queue::~Queue() {
+	if(executor) {
+		wait();
+	}
+}
+
+
+void Executor::Queue::wait() {
+	if(!executor) {
+		pool->wait();
+		return;
+	}
+	Lock lock(executor->mut);
+	while(!tasks.empty() || running) {
+		cond.wait(lock);
+	}
+}
+
+
+void Executor::Queue::submit(Task task) {
+	if(!executor) {
+		pool->submit(std::move(task));
+		return;
+	}
+	if(executor->threads.empty()) {
+		task(0);
+		return;
+	}
+
+	{
+		Lock lock(executor->mut);
+		while(tasks.size() >= capacity) {
+			cond.wait(lock);
+		}
+		tasks.push_back(std::move(task));
+		if(!ready) {
+			ready = true;
+			executor->readyQueues.push_back(this);
+		}
+	}
+	executor->condWork.notify_one();
+}
+
+
+unsigned Executor::Queue::size() const {
+	return executor ? executor->size() : pool->size();
+}
+
+
+Executor::Lease::Lease(Executor* executor, const Shape* shapes, size_t nShape)
+	: executor(executor)
+	, shapes(shapes, shapes + nShape)
+	, pools()
+{
+	if(executor) {
+		executor->acquire(this->shapes, pools);
+	} else {
+		for(const auto& s : this->shapes) {
+			pools.emplace_back(new MemPool(s.elementSize, s.elementCount, s.policy));
+		}
+	}
+}
+
+
+Executor::Lease::~Lease() {
+	if(executor) {
+		executor->release(shapes, pools);
+	}
+}
+
+
+MemPool& Executor::Lease::operator[](size_t i) {
+	return *pools[i];
+}
+
+} // namespace Lz4Mt
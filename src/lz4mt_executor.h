@@ -0,0 +1,127 @@
+#ifndef LZ4MT_EXECUTOR_H
+#define LZ4MT_EXECUTOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "lz4mt_mempool.h"
+#include "lz4mt_threadpool.h"
+
+namespace Lz4Mt {
+
+///	Worker threads and block buffers shared by concurrent streams.
+///
+///	Each stream submits to its own Queue.  Workers take one task from
+///	each queue with pending tasks in turn, so a stream with a deep window
+///	cannot starve the others, and the tasks of one queue still start in
+///	submission order.
+///
+///	The buffer pools of the streams are Leases.  Together with the idle
+///	pools kept for reuse they stay under memoryLimit bytes (0 : no
+///	limit) : a Lease waits until enough memory is given back, unless no
+///	other Lease is out.
+class Executor {
+public:
+	typedef ThreadPool::Task Task;
+
+	Executor(unsigned nThread, uint64_t memoryLimit, uint64_t affinityMask);
+	~Executor();
+	unsigned size() const;
+
+	///	Workers of one stream.  Without an executor the queue runs its
+	///	own ThreadPool of nThread workers.  wait(), and the destructor,
+	///	return once every task of the queue has returned.
+	class Queue {
+	public:
+		Queue(Executor* executor, size_t capacity
+			  , unsigned nThread, uint64_t affinityMask);
+		~Queue();
+		void submit(Task task);
+		void wait();
+		unsigned size() const;
+
+	private:
+		friend class Executor;
+		Queue(const Queue&);
+		const Queue& operator=(const Queue&);
+
+		Executor* executor;
+		std::unique_ptr<ThreadPool> pool;
+		size_t capacity;
+		std::deque<Task> tasks;
+		unsigned running;
+		bool ready;
+		std::condition_variable cond;
+	};
+
+	struct Shape {
+		size_t				elementSize;
+		size_t				elementCount;
+		MemPool::Policy		policy;
+	};
+
+	///	Buffer pools of one stream, all taken at once so that two streams
+	///	cannot each hold a part of what they need.  Without an executor
+	///	the pools are simply allocated.
+	class Lease {
+	public:
+		Lease(Executor* executor, const Shape* shapes, size_t nShape);
+		~Lease();
+		MemPool& operator[](size_t i);
+
+	private:
+		Lease(const Lease&);
+		const Lease& operator=(const Lease&);
+
+		Executor* executor;
+		std::vector<Shape> shapes;
+		std::vector<std::unique_ptr<MemPool>> pools;
+	};
+
+private:
+	Executor(const Executor&);
+	const Executor& operator=(const Executor&);
+
+	struct Idle {
+		Shape					shape;
+		std::unique_ptr<MemPool>	pool;
+	};
+
+	typedef std::unique_lock<std::mutex> Lock;
+
+	void worker(unsigned index, uint64_t affinityMask);
+	void acquire(const std::vector<Shape>& shapes
+				 , std::vector<std::unique_ptr<MemPool>>& pools);
+	void release(const std::vector<Shape>& shapes
+				 , std::vector<std::unique_ptr<MemPool>>& pools);
+
+	bool stop;
+	std::mutex mut;
+	std::condition_variable condWork;
+	std::deque<Queue*> readyQueues;
+	std::vector<std::thread> threads;
+
+	std::mutex memMut;
+	std::condition_variable memCond;
+	const uint64_t memoryLimit;
+	uint64_t memoryUsed;		// leases and idle pools
+	unsigned leases;
+	std::deque<Idle> idle;		// most recently released last
+};
+
+} // namespace Lz4Mt
+
+
+struct Lz4MtExecutor {
+	Lz4MtExecutor(unsigned nThread, uint64_t memoryLimit, uint64_t affinityMask)
+		: executor(nThread, memoryLimit, affinityMask)
+	{}
+
+	Lz4Mt::Executor executor;
+};
+
+#endif // LZ4MT_EXECUTOR_H
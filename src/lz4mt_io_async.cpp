@@ -0,0 +1,710 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include "lz4mt_io_async.h"
+#include "lz4mt_io_cstdio.h"
+#include "lz4mt_mempool.h"
+#include "lz4mt.h"
+
+namespace {
+
+typedef std::unique_lock<std::mutex> Lock;
+typedef Lz4Mt::MemPool::Buffer Buffer;
+
+const size_t CHUNK_SIZE = 1 << 20;
+const size_t CHUNK_DEPTH = 8;			// chunks queued between the threads
+const size_t INPUT_CHUNK_SIZE = 4 << 20;
+const size_t INPUT_CHUNK_DEPTH = 4;
+const size_t INPUT_CHUNK_LENT = 4;		// held by lent spans before the thread waits
+const size_t DIRECT_ALIGNMENT = 4096;	// O_DIRECT buffer, size and offset
+const size_t HISTORY_SIZE = 64;			// how far readSeek() goes back
+
+bool directIo = false;
+
+Lz4Mt::MemPool::Policy chunkPolicy() {
+	Lz4Mt::MemPool::Policy p;
+	p.alignment = DIRECT_ALIGNMENT;
+	return p;
+}
+
+#if defined(_WIN32)
+int openFile(const std::string& filename, bool output) {
+	const int flags = output ? (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+							 : (_O_RDONLY | _O_BINARY);
+	int fd = -1;
+	::_sopen_s(&fd, filename.c_str(), flags, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+	return fd;
+}
+
+int stdFile(int fd) {
+	(void) ::_setmode(fd, _O_BINARY);
+	return fd;
+}
+
+void closeFile(int fd) {
+	::_close(fd);
+}
+
+bool clearDirect(int) {
+	return false;
+}
+
+long readFile(int fd, char* p, size_t n) {
+	return ::_read(fd, p, static_cast<unsigned>(n));
+}
+
+// Leaves the file position alone, for the read-ahead thread.
+long readFileAt(int fd, char* p, size_t n, uint64_t offset) {
+	OVERLAPPED ov = {};
+	ov.Offset = static_cast<DWORD>(offset);
+	ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	DWORD r = 0;
+	auto* h = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+	if(!::ReadFile(h, p, static_cast<DWORD>(n), &r, &ov)) {
+		return -1;
+	}
+	return static_cast<long>(r);
+}
+
+uint64_t getFileSize(int fd) {
+	struct _stat64 s = { 0 };
+	if(::_fstat64(fd, &s) || (s.st_mode & S_IFMT) != S_IFREG) {
+		return 0;
+	}
+	return static_cast<uint64_t>(s.st_size);
+}
+
+long writeFile(int fd, const char* p, size_t n) {
+	return ::_write(fd, p, static_cast<unsigned>(n));
+}
+#else
+int openFile(const std::string& filename, bool output) {
+	const int flags = output ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+#if defined(O_DIRECT)
+	if(directIo) {
+		const int fd = ::open(filename.c_str(), flags | O_DIRECT, 0666);
+		if(fd >= 0) {
+			return fd;
+		}
+	}
+#endif
+	const int fd = ::open(filename.c_str(), flags, 0666);
+#if defined(POSIX_FADV_SEQUENTIAL)
+	if(fd >= 0 && !output) {
+		(void) ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
+	return fd;
+}
+
+int stdFile(int fd) {
+	return fd;
+}
+
+void closeFile(int fd) {
+	::close(fd);
+}
+
+// Returns true when O_DIRECT was set.
+bool clearDirect(int fd) {
+#if defined(O_DIRECT)
+	const int flags = ::fcntl(fd, F_GETFL);
+	if(flags >= 0 && (flags & O_DIRECT)) {
+		return 0 == ::fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+	}
+#else
+	(void) fd;
+#endif
+	return false;
+}
+
+long readFile(int fd, char* p, size_t n) {
+	for(;;) {
+		const auto r = ::read(fd, p, n);
+		if(r >= 0 || EINTR != errno) {
+			return static_cast<long>(r);
+		}
+	}
+}
+
+// Leaves the file position alone, for the read-ahead thread.
+long readFileAt(int fd, char* p, size_t n, uint64_t offset) {
+	for(;;) {
+		const auto r = ::pread(fd, p, n, static_cast<off_t>(offset));
+		if(r >= 0 || EINTR != errno) {
+			return static_cast<long>(r);
+		}
+	}
+}
+
+uint64_t getFileSize(int fd) {
+	struct stat s;
+	if(::fstat(fd, &s) || !S_ISREG(s.st_mode)) {
+		return 0;
+	}
+	return static_cast<uint64_t>(s.st_size);
+}
+
+long writeFile(int fd, const char* p, size_t n) {
+	for(;;) {
+		const auto r = ::write(fd, p, n);
+		if(r >= 0 || EINTR != errno) {
+			return static_cast<long>(r);
+		}
+	}
+}
+#endif
+
+// Fills p up to n bytes.  end is raised by the end of file or an error,
+// which the consumer sees as a short read.  A file system which refuses
+// an O_DIRECT transfer gets a cached one.
+size_t readAll(int fd, char* p, size_t n, bool& end) {
+	size_t done = 0;
+	while(done < n) {
+		const auto r = readFile(fd, p + done, n - done);
+		if(r < 0 && clearDirect(fd)) {
+			continue;
+		}
+		if(r <= 0) {
+			end = true;
+			break;
+		}
+		done += static_cast<size_t>(r);
+	}
+	return done;
+}
+
+// O_DIRECT only moves whole sectors : the unaligned tail of the last chunk
+// is written through the cache.
+bool writeAll(int fd, const char* p, size_t n) {
+	size_t done = 0;
+	if(n % DIRECT_ALIGNMENT) {
+		const auto aligned = n - n % DIRECT_ALIGNMENT;
+		if(aligned && !writeAll(fd, p, aligned)) {
+			return false;
+		}
+		done = aligned;
+		clearDirect(fd);
+	}
+	while(done < n) {
+		const auto r = writeFile(fd, p + done, n - done);
+		if(r < 0 && clearDirect(fd)) {
+			continue;
+		}
+		if(r <= 0) {
+			return false;
+		}
+		done += static_cast<size_t>(r);
+	}
+	return true;
+}
+
+
+///	Chunks read ahead by the thread, consumed in order by read() and
+///	view().  A span lent by view() keeps its chunk out of the pool until
+///	release() gives it back.
+class Istream {
+public:
+	Istream(int fd, bool owner)
+		: fd(fd)
+		, owner(owner)
+		, pool(INPUT_CHUNK_SIZE, INPUT_CHUNK_DEPTH + 2 + INPUT_CHUNK_LENT, chunkPolicy())
+		, mut()
+		, cond()
+		, filled()
+		, done(false)
+		, stop(false)
+		, cur()
+		, pos(0)
+		, eof(false)
+		, history()
+		, pushback()
+		, lentMut()
+		, lent()
+		, thread(&Istream::run, this)
+	{}
+
+	~Istream() {
+		{
+			Lock lock(mut);
+			stop = true;
+		}
+		cond.notify_all();
+		// the thread may wait for a chunk they hold
+		cur.reset();
+		{
+			Lock lock(lentMut);
+			lent.clear();
+		}
+		thread.join();
+		if(owner) {
+			closeFile(fd);
+		}
+	}
+
+	int read(void* dst, int size) {
+		auto* d = static_cast<char*>(dst);
+		const auto k = std::min<size_t>(size, pushback.size());
+		std::copy(pushback.begin(), pushback.begin() + k, d);
+		pushback.erase(pushback.begin(), pushback.begin() + k);
+		int n = static_cast<int>(k);
+		while(n < size) {
+			if(!cur && !next()) {
+				eof = true;
+				break;
+			}
+			const auto m = std::min<size_t>(size - n, cur->size() - pos);
+			memcpy(d + n, cur->data() + pos, m);
+			n += static_cast<int>(m);
+			pos += m;
+			if(pos == cur->size()) {
+				cur.reset();
+			}
+		}
+		remember(d, n);
+		return n;
+	}
+
+	// Lends the next size bytes where they are in their chunk, or a copy
+	// of them when they cross into the next one.
+	int view(const void** ptr, int size) {
+		*ptr = nullptr;
+		if(size <= 0) {
+			return 0;
+		}
+		Span span;
+		if(pushback.empty() && (cur || next()) && cur->size() - pos >= static_cast<size_t>(size)) {
+			const auto* p = cur->data() + pos;
+			pos += size;
+			span.chunk = cur;
+			if(pos == cur->size()) {
+				cur.reset();
+			}
+			remember(p, size);
+			*ptr = p;
+		} else {
+			std::vector<char> copy(size);
+			const auto n = read(copy.data(), size);
+			if(0 == n) {
+				return 0;
+			}
+			copy.resize(n);
+			span.copy.swap(copy);
+			*ptr = span.copy.data();
+			size = n;
+		}
+		Lock lock(lentMut);
+		lent.push_back(Span());
+		lent.back().chunk.swap(span.chunk);
+		lent.back().copy.swap(span.copy);
+		return size;
+	}
+
+	// Spans come back in the order they were lent.
+	void release() {
+		Lock lock(lentMut);
+		if(!lent.empty()) {
+			lent.pop_front();
+		}
+	}
+
+	// Like fseek(), skipping past the end succeeds; the next read is short.
+	void skip(uint64_t size) {
+		const auto k = std::min<uint64_t>(size, pushback.size());
+		pushback.erase(pushback.begin(), pushback.begin() + static_cast<size_t>(k));
+		size -= k;
+		while(size > 0 && (cur || next())) {
+			const auto m = std::min<uint64_t>(size, cur->size() - pos);
+			size -= m;
+			pos += static_cast<size_t>(m);
+			if(pos == cur->size()) {
+				cur.reset();
+			}
+		}
+		history.clear();
+		eof = false;
+	}
+
+	int seekBack(size_t size) {
+		if(size > history.size()) {
+			return -1;
+		}
+		pushback.insert(pushback.begin(), history.end() - size, history.end());
+		history.resize(history.size() - size);
+		eof = false;
+		return 0;
+	}
+
+	bool isEof() const {
+		return eof;
+	}
+
+	// Thread safe, like pread().  Buffers of the library are not aligned
+	// for O_DIRECT : the file falls back to cached reads.
+	int readAt(void* dst, int size, uint64_t offset) {
+		auto* d = static_cast<char*>(dst);
+		int n = 0;
+		while(n < size) {
+			const auto r = readFileAt(fd, d + n, size - n, offset + n);
+			if(r < 0 && clearDirect(fd)) {
+				continue;
+			}
+			if(r <= 0) {
+				break;
+			}
+			n += static_cast<int>(r);
+		}
+		return n;
+	}
+
+	uint64_t fileSize() const {
+		return getFileSize(fd);
+	}
+
+private:
+	Istream(const Istream&);
+	const Istream& operator=(const Istream&);
+
+	struct Span {
+		Span()
+			: chunk()
+			, copy()
+		{}
+
+		std::shared_ptr<Buffer> chunk;	// lent from it, or
+		std::vector<char> copy;			// copied out of the chunks
+	};
+
+	bool next() {
+		Lock lock(mut);
+		while(!done && filled.empty()) {
+			cond.wait(lock);
+		}
+		if(filled.empty()) {
+			return false;
+		}
+		cur = std::make_shared<Buffer>(std::move(filled.front()));
+		filled.pop_front();
+		pos = 0;
+		lock.unlock();
+		cond.notify_all();
+		return true;
+	}
+
+	void remember(const char* p, int n) {
+		const auto k = std::min<size_t>(n, HISTORY_SIZE);
+		history.insert(history.end(), p + n - k, p + n);
+		if(history.size() > HISTORY_SIZE) {
+			history.erase(history.begin(), history.end() - HISTORY_SIZE);
+		}
+	}
+
+	// At most INPUT_CHUNK_DEPTH chunks wait in filled, read() holds one
+	// more and the thread fills another.  alloc() only blocks while lent
+	// spans hold more than INPUT_CHUNK_LENT chunks.
+	void run() {
+		bool end = false;
+		while(!end) {
+			{
+				Lock lock(mut);
+				while(!stop && filled.size() >= INPUT_CHUNK_DEPTH) {
+					cond.wait(lock);
+				}
+				if(stop) {
+					break;
+				}
+			}
+			auto b = pool.alloc();
+			b.resize(readAll(fd, b.data(), INPUT_CHUNK_SIZE, end));
+			if(b.size()) {
+				Lock lock(mut);
+				filled.push_back(std::move(b));
+			}
+			cond.notify_all();
+		}
+		{
+			Lock lock(mut);
+			done = true;
+		}
+		cond.notify_all();
+	}
+
+	int fd;
+	bool owner;
+	Lz4Mt::MemPool pool;
+	std::mutex mut;
+	std::condition_variable cond;
+	std::deque<Buffer> filled;
+	bool done;
+	bool stop;
+	std::shared_ptr<Buffer> cur;
+	size_t pos;
+	bool eof;
+	std::vector<char> history;		// the last bytes read
+	std::vector<char> pushback;		// read again before cur
+	std::mutex lentMut;				// release() runs on the workers
+	std::deque<Span> lent;
+	std::thread thread;
+};
+
+
+///	write() gathers into chunks, the thread writes full ones in order.
+class Ostream {
+public:
+	Ostream(int fd, bool owner)
+		: fd(fd)
+		, owner(owner)
+		, pool(CHUNK_SIZE, CHUNK_DEPTH + 2, chunkPolicy())
+		, mut()
+		, cond()
+		, queue()
+		, stop(false)
+		, failed(false)
+		, cur()
+		, thread(&Ostream::run, this)
+	{}
+
+	~Ostream() {
+		if(cur.valid() && cur.size()) {
+			push();
+		}
+		{
+			Lock lock(mut);
+			stop = true;
+		}
+		cond.notify_all();
+		thread.join();
+		if(owner) {
+			closeFile(fd);
+		}
+	}
+
+	int write(const void* src, int size) {
+		if(failed) {
+			return 0;
+		}
+		const auto* s = static_cast<const char*>(src);
+		int n = 0;
+		while(n < size) {
+			if(!cur.valid()) {
+				cur = pool.alloc();
+				cur.resize(0);
+			}
+			const auto m = std::min<size_t>(size - n, CHUNK_SIZE - cur.size());
+			memcpy(cur.data() + cur.size(), s + n, m);
+			cur.resize(cur.size() + m);
+			n += static_cast<int>(m);
+			if(CHUNK_SIZE == cur.size()) {
+				push();
+			}
+		}
+		return n;
+	}
+
+private:
+	Ostream(const Ostream&);
+	const Ostream& operator=(const Ostream&);
+
+	// At most CHUNK_DEPTH chunks wait in queue, the thread writes one more
+	// and write() fills the last one : alloc() never blocks.
+	void push() {
+		Lock lock(mut);
+		while(queue.size() >= CHUNK_DEPTH) {
+			cond.wait(lock);
+		}
+		queue.push_back(std::move(cur));
+		lock.unlock();
+		cond.notify_all();
+	}
+
+	void run() {
+		for(;;) {
+			Buffer b;
+			{
+				Lock lock(mut);
+				while(!stop && queue.empty()) {
+					cond.wait(lock);
+				}
+				if(queue.empty()) {
+					break;
+				}
+				b = std::move(queue.front());
+				queue.pop_front();
+			}
+			cond.notify_all();
+			if(!failed && !writeAll(fd, b.data(), b.size())) {
+				failed = true;
+			}
+		}
+	}
+
+	int fd;
+	bool owner;
+	Lz4Mt::MemPool pool;
+	std::mutex mut;
+	std::condition_variable cond;
+	std::deque<Buffer> queue;
+	bool stop;
+	std::atomic<bool> failed;
+	Buffer cur;
+	std::thread thread;
+};
+
+
+Istream* readCtx(const Lz4MtContext* ctx) {
+	return reinterpret_cast<Istream*>(ctx->readCtx);
+}
+
+Ostream* writeCtx(const Lz4MtContext* ctx) {
+	return reinterpret_cast<Ostream*>(ctx->writeCtx);
+}
+
+int asyncRead(Lz4MtContext* ctx, void* dst, int dstSize) {
+	auto* is = readCtx(ctx);
+	return (is && dstSize > 0) ? is->read(dst, dstSize) : 0;
+}
+
+int readView(Lz4MtContext* ctx, const void** ptr, int size) {
+	auto* is = readCtx(ctx);
+	if(!is) {
+		*ptr = nullptr;
+		return 0;
+	}
+	return is->view(ptr, size);
+}
+
+void readRelease(Lz4MtContext* ctx, const void*, int) {
+	if(auto* is = readCtx(ctx)) {
+		is->release();
+	}
+}
+
+int readSkippable(const Lz4MtContext* ctx
+				  , uint32_t //magicNumber
+				  , size_t size)
+{
+	if(auto* is = readCtx(ctx)) {
+		is->skip(size);
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+int readSeek(const Lz4MtContext* ctx, int offset) {
+	auto* is = readCtx(ctx);
+	if(!is) {
+		return -1;
+	}
+	if(offset < 0) {
+		return is->seekBack(static_cast<size_t>(-static_cast<int64_t>(offset)));
+	}
+	is->skip(static_cast<uint64_t>(offset));
+	return 0;
+}
+
+int readAt(Lz4MtContext* ctx, void* dst, int dstSize, uint64_t offset) {
+	auto* is = readCtx(ctx);
+	return (is && dstSize > 0) ? is->readAt(dst, dstSize, offset) : 0;
+}
+
+uint64_t readSize(const Lz4MtContext* ctx) {
+	auto* is = readCtx(ctx);
+	return is ? is->fileSize() : 0;
+}
+
+int readEof(const Lz4MtContext* ctx) {
+	if(auto* is = readCtx(ctx)) {
+		return is->isEof() ? 1 : 0;
+	} else {
+		return 1;
+	}
+}
+
+int asyncWrite(const Lz4MtContext* ctx, const void* source, int sourceSize) {
+	auto* os = writeCtx(ctx);
+	return (os && sourceSize > 0) ? os->write(source, sourceSize) : 0;
+}
+
+} // anonymous namespace
+
+namespace Lz4Mt { namespace Async {
+
+bool openIstream(Lz4MtContext* ctx, const std::string& filename) {
+	const bool stdinput = Cstdio::getStdinFilename() == filename;
+	const int fd = stdinput ? stdFile(0) : openFile(filename, false);
+	if(fd < 0) {
+		ctx->readCtx = nullptr;
+		return false;
+	}
+	ctx->readCtx		= new Istream(fd, !stdinput);
+	ctx->read			= asyncRead;
+	ctx->readView		= readView;
+	ctx->readRelease	= readRelease;
+	ctx->readSkippable	= readSkippable;
+	ctx->readSeek		= readSeek;
+	ctx->readEof		= readEof;
+	ctx->readAt			= readAt;
+	ctx->readSize		= readSize;
+	return true;
+}
+
+bool openOstream(Lz4MtContext* ctx, const std::string& filename, bool nullWrite) {
+	if(nullWrite) {
+		ctx->write = Cstdio::write;
+		ctx->writeGather = Cstdio::writeGather;
+		return Cstdio::openOstream(ctx, filename, nullWrite);
+	}
+	const bool stdoutput = Cstdio::getStdoutFilename() == filename;
+	const int fd = stdoutput ? stdFile(1) : openFile(filename, true);
+	if(fd < 0) {
+		ctx->writeCtx = nullptr;
+		return false;
+	}
+	ctx->writeCtx		= new Ostream(fd, !stdoutput);
+	ctx->write			= asyncWrite;
+	ctx->writeReserve	= nullptr;
+	ctx->writeUnreserve	= nullptr;
+	ctx->writeGather	= nullptr;
+	return true;
+}
+
+void closeIstream(Lz4MtContext* ctx) {
+	delete readCtx(ctx);
+	ctx->readCtx = nullptr;
+}
+
+void closeOstream(Lz4MtContext* ctx) {
+	if(ctx->write != asyncWrite) {
+		Cstdio::closeOstream(ctx);
+		return;
+	}
+	delete writeCtx(ctx);
+	ctx->writeCtx = nullptr;
+}
+
+void enableDirectIo(bool enable) {
+	directIo = enable;
+}
+
+}} // namespace Async, Lz4Mt
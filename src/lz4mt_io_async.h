@@ -0,0 +1,35 @@
+#ifndef LZ4MT_IO_ASYNC_H
+#define LZ4MT_IO_ASYNC_H
+
+#include <string>
+
+struct Lz4MtContext;
+
+namespace Lz4Mt { namespace Async {
+
+///	Read ahead and write behind on background threads.
+///
+///	The input is read in 4MB chunks by its own thread, several chunks
+///	ahead of the library, which takes its blocks as views into them : only
+///	a block which crosses two chunks is copied.  Output is gathered into chunks which another
+///	thread writes while the next ones fill, so disk latency overlaps the
+///	compression instead of stalling the ordered write stage.  stdin and
+///	stdout are streamed the same way; the null output falls back to
+///	Lz4Mt::Cstdio.  readSeek() only goes back up to 64 bytes.  readAt()
+///	reads the file with pread(), apart from the read ahead.
+///
+///	A write error is returned by the next write() call.  As with stdio
+///	buffering, an error while the last chunk is flushed by
+///	closeOstream() is lost.
+bool openIstream(Lz4MtContext* ctx, const std::string& filename);
+bool openOstream(Lz4MtContext* ctx, const std::string& filename, bool nullWrite);
+void closeIstream(Lz4MtContext* ctx);
+void closeOstream(Lz4MtContext* ctx);
+
+///	Files opened after this call bypass the page cache (O_DIRECT) when
+///	the file system allows it.  Ignored on Windows.
+void enableDirectIo(bool enable);
+
+}}
+
+#endif
@@ -2,11 +2,17 @@
 #include <sys/stat.h>
 #include <string.h>
 #ifdef _WIN32
+#include <windows.h>
 #include <io.h>
 #include <fcntl.h>
 #else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
+#include <algorithm>
 
 #include "lz4mt_io_cstdio.h"
 #include "lz4mt.h"
@@ -78,6 +84,12 @@ bool openIstream(Lz4MtContext* ctx, const std::string& filename) {
 		fp = getStdin();
 	} else {
 		fp = fopen_(filename.c_str(), "rb");
+#if defined(POSIX_FADV_SEQUENTIAL)
+		if(fp) {
+			// larger read ahead by the kernel
+			(void) ::posix_fadvise(::fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+#endif
 	}
 	ctx->readCtx = fp;
 	return nullptr != fp;
@@ -144,6 +156,58 @@ int readEof(const Lz4MtContext* ctx) {
 	}
 }
 
+int readAt(Lz4MtContext* ctx, void* dst, int dstSize, uint64_t offset) {
+	auto* fp = readCtx(ctx);
+	if(!fp || dstSize <= 0) {
+		return 0;
+	}
+	auto* p = static_cast<char*>(dst);
+	int done = 0;
+	while(done < dstSize) {
+		const auto o = offset + done;
+#if defined(_WIN32)
+		OVERLAPPED ov = {};
+		ov.Offset = static_cast<DWORD>(o);
+		ov.OffsetHigh = static_cast<DWORD>(o >> 32);
+		DWORD n = 0;
+		auto* h = reinterpret_cast<HANDLE>(::_get_osfhandle(::_fileno(fp)));
+		if(!::ReadFile(h, p + done, static_cast<DWORD>(dstSize - done), &n, &ov)) {
+			n = 0;
+		}
+#else
+		const auto n = ::pread(::fileno(fp), p + done, dstSize - done
+							   , static_cast<off_t>(o));
+#endif
+		if(n <= 0) {
+			break;
+		}
+		done += static_cast<int>(n);
+	}
+	return done;
+}
+
+uint64_t readSize(const Lz4MtContext* ctx) {
+	auto* fp = readCtx(ctx);
+	if(!fp) {
+		return 0;
+	}
+#if defined(_MSC_VER)
+	struct _stat64 s = { 0 };
+	const auto r = _fstat64(_fileno(fp), &s);
+	auto S_ISREG = [](decltype(s.st_mode) x) {
+		return (x & S_IFMT) == S_IFREG;
+	};
+#else
+	struct stat s;
+	const auto r = fstat(fileno(fp), &s);
+#endif
+	if(r || !S_ISREG(s.st_mode)) {
+		return 0;
+	} else {
+		return static_cast<uint64_t>(s.st_size);
+	}
+}
+
 int write(const Lz4MtContext* ctx, const void* source, int sourceSize) {
 	if(auto* fp = writeCtx(ctx)) {
 		if(isNullFp(ctx, fp)) {
@@ -155,6 +219,66 @@ int write(const Lz4MtContext* ctx, const void* source, int sourceSize) {
 	}
 }
 
+int writeGather(const Lz4MtContext* ctx, const Lz4MtSpan* spans, int nSpan) {
+	auto* fp = writeCtx(ctx);
+	if(!fp) {
+		return 0;
+	}
+	int size = 0;
+	for(int i = 0; i < nSpan; ++i) {
+		size += spans[i].size;
+	}
+	if(isNullFp(ctx, fp)) {
+		return size;
+	}
+#if defined(_WIN32)
+	int done = 0;
+	for(int i = 0; i < nSpan; ++i) {
+		const auto n = static_cast<int>(::fwrite(spans[i].ptr, 1, spans[i].size, fp));
+		done += n;
+		if(n != spans[i].size) {
+			break;
+		}
+	}
+	return done;
+#else
+	// Whatever fwrite() still buffers goes first.
+	if(::fflush(fp)) {
+		return 0;
+	}
+	const int nIov = 64;
+	struct iovec iov[nIov];
+	int done = 0;
+	int i = 0;
+	size_t skip = 0;	// of spans[i], already written
+	while(i < nSpan) {
+		int n = 0;
+		for(; n < nIov && i + n < nSpan; ++n) {
+			const auto& s = spans[i + n];
+			const size_t k = n ? 0 : skip;
+			iov[n].iov_base = const_cast<char*>(static_cast<const char*>(s.ptr)) + k;
+			iov[n].iov_len = static_cast<size_t>(s.size) - k;
+		}
+		const auto r = ::writev(::fileno(fp), iov, n);
+		if(r < 0 && EINTR == errno) {
+			continue;
+		}
+		if(r <= 0) {
+			break;
+		}
+		done += static_cast<int>(r);
+		auto left = static_cast<size_t>(r);
+		while(i < nSpan && left >= static_cast<size_t>(spans[i].size) - skip) {
+			left -= static_cast<size_t>(spans[i].size) - skip;
+			skip = 0;
+			++i;
+		}
+		skip += left;
+	}
+	return done;
+#endif
+}
+
 uint64_t getFilesize(const std::string& fileanme) {
 	int r = 0;
 #if defined(_MSC_VER)
@@ -174,6 +298,50 @@ uint64_t getFilesize(const std::string& fileanme) {
 	}
 }
 
+bool isDirectory(const std::string& filename) {
+#if defined(_MSC_VER)
+	struct _stat64 s = { 0 };
+	const int r = _stat64(filename.c_str(), &s);
+	return 0 == r && (s.st_mode & S_IFMT) == S_IFDIR;
+#else
+	struct stat s;
+	const int r = stat(filename.c_str(), &s);
+	return 0 == r && S_ISDIR(s.st_mode);
+#endif
+}
+
+std::vector<std::string> listDirectory(const std::string& dirname) {
+	std::vector<std::string> names;
+#if defined(_WIN32)
+	const char sep = '\\';
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA((dirname + sep + "*").c_str(), &fd);
+	if(INVALID_HANDLE_VALUE != h) {
+		do {
+			names.push_back(fd.cFileName);
+		} while(FindNextFileA(h, &fd));
+		FindClose(h);
+	}
+#else
+	const char sep = '/';
+	if(DIR* d = opendir(dirname.c_str())) {
+		while(const struct dirent* e = readdir(d)) {
+			names.push_back(e->d_name);
+		}
+		closedir(d);
+	}
+#endif
+	names.erase(std::remove_if(names.begin(), names.end()
+		, [](const std::string& n) { return "." == n || ".." == n; })
+		, names.end());
+	std::sort(names.begin(), names.end());
+	const bool hasSep = !dirname.empty() && sep == dirname.back();
+	for(auto& n : names) {
+		n = hasSep ? dirname + n : dirname + sep + n;
+	}
+	return names;
+}
+
 std::string getStdinFilename() {
 	return stdinFilename;
 }
@@ -3,8 +3,10 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
 
 struct Lz4MtContext;
+struct Lz4MtSpan;
 
 namespace Lz4Mt { namespace Cstdio {
 
@@ -17,8 +19,13 @@ int read(Lz4MtContext* ctx, void* dst, int dstSize);
 int readSkippable(const Lz4MtContext* ctx, uint32_t magicNumber, size_t size);
 int readSeek(const Lz4MtContext* ctx, int offset);
 int readEof(const Lz4MtContext* ctx);
+int readAt(Lz4MtContext* ctx, void* dst, int dstSize, uint64_t offset);	// pread(), thread safe
+uint64_t readSize(const Lz4MtContext* ctx);
 int write(const Lz4MtContext* ctx, const void* source, int sourceSize);
+int writeGather(const Lz4MtContext* ctx, const Lz4MtSpan* spans, int nSpan);	// writev()
 uint64_t getFilesize(const std::string& fileanme);
+bool isDirectory(const std::string& filename);
+std::vector<std::string> listDirectory(const std::string& dirname);	// sorted paths, without "." and ".."
 std::string getStdinFilename();
 std::string getStdoutFilename();
 std::string getNullFilename();
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "lz4mt_io_mmap.h"
+#include "lz4mt_io_cstdio.h"
+#include "lz4mt.h"
+
+namespace {
+
+struct Istream {
+	Istream(const char* data, uint64_t size)
+		: data(data)
+		, size(size)
+		, pos(0)
+		, eof(false)
+	{}
+
+	const char* data;
+	uint64_t size;
+	uint64_t pos;
+	bool eof;
+};
+
+#if !defined(_WIN32)
+struct Ostream {
+	struct Region {
+		void* ptr;
+		size_t size;
+	};
+
+	explicit Ostream(int fd)
+		: fd(fd)
+		, pos(0)
+		, regions()
+	{}
+
+	int fd;
+	uint64_t pos;
+	std::vector<Region> regions;
+};
+#endif
+
+Istream* readCtx(const Lz4MtContext* ctx) {
+	return reinterpret_cast<Istream*>(ctx->readCtx);
+}
+
+// Takes what is left of the mapping, at most size bytes.  Like feof(),
+// the end of file flag is only raised by a short read.
+int take(Lz4MtContext* ctx, const char** ptr, int size) {
+	auto* is = readCtx(ctx);
+	if(!is || size < 0) {
+		return 0;
+	}
+	const auto n = static_cast<int>(
+		std::min<uint64_t>(static_cast<uint64_t>(size), is->size - is->pos));
+	*ptr = is->data + is->pos;
+	is->pos += n;
+	if(n < size) {
+		is->eof = true;
+	}
+	return n;
+}
+
+int mapRead(Lz4MtContext* ctx, void* dst, int dstSize) {
+	const char* p = nullptr;
+	const int n = take(ctx, &p, dstSize);
+	if(n > 0) {
+		memcpy(dst, p, n);
+	}
+	return n;
+}
+
+int readView(Lz4MtContext* ctx, const void** ptr, int size) {
+	const char* p = nullptr;
+	const int n = take(ctx, &p, size);
+	*ptr = p;
+	return n;
+}
+
+int readSkippable(const Lz4MtContext* ctx
+				  , uint32_t //magicNumber
+				  , size_t size)
+{
+	if(auto* is = readCtx(ctx)) {
+		// fseek() past the end succeeds as well; the next read is short.
+		is->pos += std::min<uint64_t>(size, is->size - is->pos);
+		is->eof = false;
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+int readSeek(const Lz4MtContext* ctx, int offset) {
+	auto* is = readCtx(ctx);
+	if(!is) {
+		return -1;
+	}
+	if(offset < 0 && static_cast<uint64_t>(-static_cast<int64_t>(offset)) > is->pos) {
+		return -1;
+	}
+	is->pos = std::min<uint64_t>(is->pos + offset, is->size);
+	is->eof = false;
+	return 0;
+}
+
+int readEof(const Lz4MtContext* ctx) {
+	if(auto* is = readCtx(ctx)) {
+		return is->eof ? 1 : 0;
+	} else {
+		return 1;
+	}
+}
+
+// Leaves the read position alone : safe to call from several threads.
+int readAt(Lz4MtContext* ctx, void* dst, int dstSize, uint64_t offset) {
+	auto* is = readCtx(ctx);
+	if(!is || dstSize < 0 || offset > is->size) {
+		return 0;
+	}
+	const auto n = static_cast<int>(
+		std::min<uint64_t>(static_cast<uint64_t>(dstSize), is->size - offset));
+	memcpy(dst, is->data + offset, n);
+	return n;
+}
+
+uint64_t readSize(const Lz4MtContext* ctx) {
+	auto* is = readCtx(ctx);
+	return is ? is->size : 0;
+}
+
+const void* mapFile(const std::string& filename, uint64_t& size) {
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ
+							  , nullptr, OPEN_EXISTING
+							  , FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(INVALID_HANDLE_VALUE == file) {
+		return nullptr;
+	}
+	LARGE_INTEGER li;
+	if(FILE_TYPE_DISK != GetFileType(file)
+	   || !GetFileSizeEx(file, &li)
+	   || li.QuadPart <= 0
+	   || static_cast<uint64_t>(li.QuadPart) > SIZE_MAX
+	) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if(!mapping) {
+		return nullptr;
+	}
+	// The view keeps the mapping object alive.
+	const void* p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	size = static_cast<uint64_t>(li.QuadPart);
+	return p;
+#else
+	const int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return nullptr;
+	}
+	struct stat s;
+	if(::fstat(fd, &s) || !S_ISREG(s.st_mode) || s.st_size <= 0
+	   || static_cast<uint64_t>(s.st_size) > SIZE_MAX
+	) {
+		::close(fd);
+		return nullptr;
+	}
+	size = static_cast<uint64_t>(s.st_size);
+	void* p = ::mmap(nullptr, static_cast<size_t>(size), PROT_READ
+					 , MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(MAP_FAILED == p) {
+		return nullptr;
+	}
+	(void) ::madvise(p, static_cast<size_t>(size), MADV_SEQUENTIAL);
+	return p;
+#endif
+}
+
+void unmapFile(const void* p, uint64_t size) {
+#if defined(_WIN32)
+	(void) size;
+	UnmapViewOfFile(p);
+#else
+	::munmap(const_cast<void*>(p), static_cast<size_t>(size));
+#endif
+}
+
+#if !defined(_WIN32)
+Ostream* writeCtx(const Lz4MtContext* ctx) {
+	return reinterpret_cast<Ostream*>(ctx->writeCtx);
+}
+
+int mapWrite(const Lz4MtContext* ctx, const void* source, int sourceSize) {
+	auto* os = writeCtx(ctx);
+	if(!os) {
+		return 0;
+	}
+	const auto* p = static_cast<const char*>(source);
+	int done = 0;
+	while(done < sourceSize) {
+		const auto n = ::pwrite(os->fd, p + done, sourceSize - done
+								, static_cast<off_t>(os->pos));
+		if(n <= 0) {
+			break;
+		}
+		done += static_cast<int>(n);
+		os->pos += n;
+	}
+	return done;
+}
+
+// Grows the file by size bytes and maps the new range.  Mappings start on
+// a page boundary, so the previous tail page is mapped again.
+void* writeReserve(const Lz4MtContext* ctx, uint64_t size) {
+	auto* os = writeCtx(ctx);
+	if(!os || 0 == size || size > SIZE_MAX / 2) {
+		return nullptr;
+	}
+	const auto page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+	const auto offset = os->pos - os->pos % page;
+	const auto delta = os->pos - offset;
+	if(::ftruncate(os->fd, static_cast<off_t>(os->pos + size))) {
+		return nullptr;
+	}
+	const auto mapSize = static_cast<size_t>(delta + size);
+	void* p = ::mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED
+					 , os->fd, static_cast<off_t>(offset));
+	if(MAP_FAILED == p) {
+		(void) ::ftruncate(os->fd, static_cast<off_t>(os->pos));
+		return nullptr;
+	}
+	const Ostream::Region r = { p, mapSize };
+	os->regions.push_back(r);
+	os->pos += size;
+	return static_cast<char*>(p) + delta;
+}
+
+// The mapping stays until the output is closed; nothing touches the
+// pages past the new end of file.
+void writeUnreserve(const Lz4MtContext* ctx, uint64_t size) {
+	auto* os = writeCtx(ctx);
+	if(!os || size > os->pos) {
+		return;
+	}
+	os->pos -= size;
+	(void) ::ftruncate(os->fd, static_cast<off_t>(os->pos));
+}
+#endif
+
+} // anonymous namespace
+
+namespace Lz4Mt { namespace Mmap {
+
+bool openIstream(Lz4MtContext* ctx, const std::string& filename) {
+	uint64_t size = 0;
+	const void* p = nullptr;
+	if(Cstdio::getStdinFilename() != filename) {
+		p = mapFile(filename, size);
+	}
+	if(!p) {
+		ctx->read			= Cstdio::read;
+		ctx->readView		= nullptr;
+		ctx->readSkippable	= Cstdio::readSkippable;
+		ctx->readSeek		= Cstdio::readSeek;
+		ctx->readEof		= Cstdio::readEof;
+		ctx->readAt			= Cstdio::readAt;
+		ctx->readSize		= Cstdio::readSize;
+		return Cstdio::openIstream(ctx, filename);
+	}
+	ctx->readCtx		= new Istream(static_cast<const char*>(p), size);
+	ctx->read			= mapRead;
+	ctx->readView		= readView;
+	ctx->readSkippable	= readSkippable;
+	ctx->readSeek		= readSeek;
+	ctx->readEof		= readEof;
+	ctx->readAt			= readAt;
+	ctx->readSize		= readSize;
+	return true;
+}
+
+bool openOstream(Lz4MtContext* ctx, const std::string& filename, bool nullWrite) {
+#if !defined(_WIN32)
+	if(!nullWrite && Cstdio::getStdoutFilename() != filename) {
+		const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+		struct stat s;
+		if(fd >= 0 && 0 == ::fstat(fd, &s) && S_ISREG(s.st_mode)) {
+			ctx->writeCtx		= new Ostream(fd);
+			ctx->write			= mapWrite;
+			ctx->writeReserve	= writeReserve;
+			ctx->writeUnreserve	= writeUnreserve;
+			ctx->writeGather	= nullptr;
+			return true;
+		}
+		if(fd >= 0) {
+			::close(fd);
+		}
+	}
+#endif
+	ctx->write			= Cstdio::write;
+	ctx->writeReserve	= nullptr;
+	ctx->writeUnreserve	= nullptr;
+	ctx->writeGather	= Cstdio::writeGather;
+	return Cstdio::openOstream(ctx, filename, nullWrite);
+}
+
+void closeIstream(Lz4MtContext* ctx) {
+	if(ctx->read != mapRead) {
+		Cstdio::closeIstream(ctx);
+		return;
+	}
+	if(auto* is = readCtx(ctx)) {
+		unmapFile(is->data, is->size);
+		delete is;
+	}
+	ctx->readCtx = nullptr;
+}
+
+void closeOstream(Lz4MtContext* ctx) {
+#if !defined(_WIN32)
+	if(ctx->write == mapWrite) {
+		if(auto* os = writeCtx(ctx)) {
+			for(const auto& r : os->regions) {
+				::munmap(r.ptr, r.size);
+			}
+			::close(os->fd);
+			delete os;
+		}
+		ctx->writeCtx = nullptr;
+		return;
+	}
+#endif
+	Cstdio::closeOstream(ctx);
+}
+
+}} // namespace Mmap, Lz4Mt
@@ -0,0 +1,25 @@
+#ifndef LZ4MT_IO_MMAP_H
+#define LZ4MT_IO_MMAP_H
+
+#include <string>
+
+struct Lz4MtContext;
+
+namespace Lz4Mt { namespace Mmap {
+
+///	Memory mapped I/O.
+///
+///	A regular input file is mapped and lent to the library through
+///	readView().  A regular output file also provides writeReserve(), and
+///	writeUnreserve() to cut it back to what was stored.
+///	Anything that cannot be mapped (stdin, stdout, pipes, the null
+///	output) falls back to Lz4Mt::Cstdio.  Both open functions install
+///	the callbacks they need into ctx.
+bool openIstream(Lz4MtContext* ctx, const std::string& filename);
+bool openOstream(Lz4MtContext* ctx, const std::string& filename, bool nullWrite);
+void closeIstream(Lz4MtContext* ctx);
+void closeOstream(Lz4MtContext* ctx);
+
+}}
+
+#endif
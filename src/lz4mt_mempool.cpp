@@ -1,29 +1,115 @@
 #include <cassert>
 #include <atomic>
-#include <future>
+#include <cstring>
 #include <mutex>
+#include <new>
 #include <vector>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #include "lz4mt_mempool.h"
+#include "lz4mt_compat.h"
 
 namespace {
 typedef std::unique_lock<std::mutex> Lock;
+
+const size_t CACHE_LINE_SIZE = 64;
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t roundUp(size_t x, size_t align) {
+	return (x + align - 1) & ~(align - 1);
+}
+
+size_t getPageSize() {
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return static_cast<size_t>(si.dwPageSize);
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Prefer (not force) placement on node, so that a full node does not make
+// the allocation fail.  Must be called before the pages are first touched.
+void bindToNumaNode(void* ptr, size_t size, unsigned node) {
+#if defined(__linux__) && defined(SYS_mbind)
+	const int MPOL_PREFERRED_ = 1;
+	const unsigned long nBits = sizeof(unsigned long) * 8;
+	if(node < nBits) {
+		const unsigned long mask = 1UL << node;
+		syscall(SYS_mbind, ptr, size, MPOL_PREFERRED_, &mask, nBits, 0);
+	}
+#else
+	(void) ptr;
+	(void) size;
+	(void) node;
+#endif
+}
+
+// freeHead packs { tag:32, index:32 }.  The tag is bumped on every update
+// so that a stale head can not be swapped back in (ABA).
+const uint32_t NIL = 0xffffffffu;
+
+uint32_t headIndex(uint64_t head) {
+	return static_cast<uint32_t>(head);
+}
+
+uint64_t makeHead(uint64_t prev, uint32_t index) {
+	return (((prev >> 32) + 1) << 32) | index;
+}
 } // anonymous namespace
 
 
 namespace Lz4Mt {
 
-MemPool::MemPool(size_t elementSize, size_t elementCount)
+MemPool::Policy::Policy()
+	: alignment(CACHE_LINE_SIZE)
+	, zeroFill(false)
+	, hugePages(false)
+	, numaNodes(1)
+{}
+
+
+MemPool::MemPool(size_t elementSize, size_t elementCount, const Policy& policy)
 	: stop(false)
+	, elementSize(elementSize)
+	, elementCount(elementCount)
+	, stride(0)
+	, nNode(1)
+	, arena(nullptr)
+	, arenaSize(0)
+	, freeHeads()
+	, freeNext(new std::atomic<uint32_t>[elementCount])
+	, waiters(0)
 	, mut()
 	, cond()
-	, freeIndexStack()
-	, elements()
 {
-	Lock lock(mut);
-	elements.reserve(elementCount);
-	for(size_t i = 0; i < elementCount; ++i) {
-		elements.emplace_back(elementSize);
-		freeIndexStack.push(static_cast<int>(i));
+	assert(elementCount < NIL);
+	if(policy.numaNodes > 1) {
+		nNode = policy.numaNodes < elementCount
+			  ? policy.numaNodes : static_cast<unsigned>(elementCount);
+	}
+	if(0 == nNode) {
+		nNode = 1;
+	}
+
+	freeHeads.reset(new std::atomic<uint64_t>[nNode]);
+	for(unsigned n = 0; n < nNode; ++n) {
+		freeHeads[n] = makeHead(0, NIL);
+	}
+
+	allocArena(policy);
+
+	for(size_t i = elementCount; i-- > 0; ) {
+		push(static_cast<uint32_t>(i));
 	}
 }
 
@@ -34,48 +120,218 @@ MemPool::~MemPool() {
 		stop = true;
 	}
 	cond.notify_all();
+	freeArena();
 }
 
 
-MemPool::Buffer* MemPool::alloc() {
-	for(;;) {
+void MemPool::allocArena(const Policy& policy) {
+	const auto pageSize = getPageSize();
+	auto align = policy.alignment ? policy.alignment : CACHE_LINE_SIZE;
+	assert(0 == (align & (align - 1)));
+	assert(align <= pageSize);
+	if(nNode > 1) {
+		// binding is per page, so give every element pages of its own
+		align = pageSize;
+	}
+	stride = roundUp(elementSize ? elementSize : 1, align);
+	arenaSize = roundUp(stride * elementCount, pageSize);
+	if(0 == arenaSize) {
+		arenaSize = pageSize;
+	}
+
+#if defined(_WIN32)
+	arena = reinterpret_cast<char*>(
+		VirtualAlloc(nullptr, arenaSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+	void* p = MAP_FAILED;
+#  if defined(MAP_HUGETLB)
+	if(policy.hugePages) {
+		const auto hugeSize = roundUp(arenaSize, HUGE_PAGE_SIZE);
+		p = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE
+				 , MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(MAP_FAILED != p) {
+			arenaSize = hugeSize;
+		}
+	}
+#  endif
+	if(MAP_FAILED == p) {
+		p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE
+				 , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#  if defined(MADV_HUGEPAGE)
+		if(MAP_FAILED != p && policy.hugePages) {
+			madvise(p, arenaSize, MADV_HUGEPAGE);
+		}
+#  endif
+	}
+	if(MAP_FAILED != p) {
+		arena = reinterpret_cast<char*>(p);
+	}
+#endif
+
+	if(!arena) {
+		throw std::bad_alloc();
+	}
+
+	if(nNode > 1) {
+		for(size_t i = 0; i < elementCount; ++i) {
+			const auto index = static_cast<uint32_t>(i);
+			bindToNumaNode(arena + i * stride, stride, nodeOf(index));
+		}
+	}
+
+	if(policy.zeroFill) {
+		memset(arena, 0, arenaSize);
+	}
+}
+
+
+void MemPool::freeArena() {
+	if(arena) {
+#if defined(_WIN32)
+		VirtualFree(arena, 0, MEM_RELEASE);
+#else
+		munmap(arena, arenaSize);
+#endif
+		arena = nullptr;
+	}
+}
+
+
+unsigned MemPool::nodeOf(uint32_t index) const {
+	return static_cast<unsigned>((static_cast<uint64_t>(index) * nNode) / elementCount);
+}
+
+
+MemPool::Buffer MemPool::alloc() {
+	auto i = pop();
+	if(NIL == i && !stop) {
 		Lock lock(mut);
-		if(!stop && freeIndexStack.empty()) {
+		++waiters;
+		while(NIL == (i = pop()) && !stop) {
 			cond.wait(lock);
 		}
-		if(stop) {
-			return new Buffer(nullptr, 0, []{});
+		--waiters;
+	}
+	return makeBuffer(i);
+}
+
+
+MemPool::Buffer MemPool::tryAlloc() {
+	return makeBuffer(pop());
+}
+
+
+MemPool::Buffer MemPool::makeBuffer(uint32_t index) {
+	if(NIL == index) {
+		return Buffer();
+	}
+	return Buffer(this, index, arena + index * stride, elementSize);
+}
+
+
+uint32_t MemPool::pop() {
+	const auto home = (nNode > 1) ? getCurrentNumaNode() % nNode : 0;
+	for(unsigned n = 0; n < nNode; ++n) {
+		const auto i = pop((home + n) % nNode);
+		if(NIL != i) {
+			return i;
+		}
+	}
+	return NIL;
+}
+
+
+uint32_t MemPool::pop(unsigned node) {
+	auto& freeHead = freeHeads[node];
+	auto head = freeHead.load();
+	for(;;) {
+		const auto i = headIndex(head);
+		if(NIL == i) {
+			return NIL;
 		}
-		if(! freeIndexStack.empty()) {
-			const auto i = freeIndexStack.top();
-			freeIndexStack.pop();
-			auto& e = elements[i];
-			return new Buffer(e.data(), e.size()
-				, [this, &e, i]() {
-					Lock lock(mut);
-					freeIndexStack.push(i);
-					cond.notify_one();
-				}
-			);
+		const auto next = freeNext[i].load(std::memory_order_relaxed);
+		if(freeHead.compare_exchange_weak(head, makeHead(head, next))) {
+			return i;
 		}
 	}
 }
 
 
-MemPool::Buffer::Buffer(char* ptr, size_t contentSize, Callback callback)
-	: ptr(ptr)
+void MemPool::push(uint32_t index) {
+	auto& freeHead = freeHeads[nodeOf(index)];
+	auto head = freeHead.load(std::memory_order_relaxed);
+	do {
+		freeNext[index].store(headIndex(head), std::memory_order_relaxed);
+	} while(!freeHead.compare_exchange_weak(head, makeHead(head, index)));
+}
+
+
+void MemPool::release(uint32_t index) {
+	push(index);
+	if(waiters.load()) {
+		Lock lock(mut);
+		cond.notify_one();
+	}
+}
+
+
+MemPool::Buffer::Buffer()
+	: pool(nullptr)
+	, index(NIL)
+	, ptr(nullptr)
+	, contentSize(0)
+{}
+
+MemPool::Buffer::Buffer(MemPool* pool, uint32_t index, char* ptr, size_t contentSize)
+	: pool(pool)
+	, index(index)
+	, ptr(ptr)
 	, contentSize(contentSize)
-	, callback(callback)
 {}
 
+MemPool::Buffer::Buffer(Buffer&& rhs)
+	: pool(rhs.pool)
+	, index(rhs.index)
+	, ptr(rhs.ptr)
+	, contentSize(rhs.contentSize)
+{
+	rhs.pool = nullptr;
+	rhs.index = NIL;
+	rhs.ptr = nullptr;
+	rhs.contentSize = 0;
+}
+
+MemPool::Buffer& MemPool::Buffer::operator=(Buffer&& rhs) {
+	if(this != &rhs) {
+		reset();
+		pool = rhs.pool;
+		index = rhs.index;
+		ptr = rhs.ptr;
+		contentSize = rhs.contentSize;
+		rhs.pool = nullptr;
+		rhs.index = NIL;
+		rhs.ptr = nullptr;
+		rhs.contentSize = 0;
+	}
+	return *this;
+}
+
 MemPool::Buffer::~Buffer() {
-	callback();
+	reset();
+}
+
+bool MemPool::Buffer::valid() const {
+	return nullptr != pool;
 }
 
 char* MemPool::Buffer::data() {
 	return ptr;
 }
 
+const char* MemPool::Buffer::data() const {
+	return ptr;
+}
+
 size_t MemPool::Buffer::size() const {
 	return contentSize;
 }
@@ -84,5 +340,15 @@ void MemPool::Buffer::resize(size_t contentSize) {
 	this->contentSize = contentSize;
 }
 
+void MemPool::Buffer::reset() {
+	if(pool) {
+		pool->release(index);
+		pool = nullptr;
+		index = NIL;
+		ptr = nullptr;
+		contentSize = 0;
+	}
+}
+
 
 } // namespace Lz4Mt
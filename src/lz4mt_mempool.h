@@ -1,46 +1,96 @@
 #ifndef LZ4MT_MEMPOOL_H
 #define LZ4MT_MEMPOOL_H
 
-#include <stack>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace Lz4Mt {
 
+///	Fixed number of equally sized buffers.
+///
+///	Free elements are kept in a lock-free stack.  alloc() only falls back
+///	to the mutex when the pool is exhausted and the caller has to wait.
 class MemPool {
 public:
 	class Buffer;
 
-	MemPool(size_t elementSize, size_t elementCount);
+	///	How the element storage is allocated.
+	///
+	///	Elements live in one arena and are never zero filled unless asked.
+	///	With numaNodes > 1 the arena is cut into one slice per node, each
+	///	slice is bound to its node, and alloc() prefers the slice of the
+	///	node the calling thread runs on.
+	struct Policy {
+		Policy();
+
+		size_t		alignment;	// power of two, element start alignment
+		bool		zeroFill;
+		bool		hugePages;	// MAP_HUGETLB, then transparent huge pages
+		unsigned	numaNodes;	// 0, 1 : no binding
+	};
+
+	MemPool(size_t elementSize, size_t elementCount, const Policy& policy = Policy());
 	~MemPool();
-	Buffer* alloc();
+	Buffer alloc();
+	Buffer tryAlloc();
 
+	///	Move-only handle to a pool element.  The element goes back to its
+	///	pool when the handle is reset or destroyed.
 	class Buffer {
-		typedef std::function<void(void)> Callback;
-
 	public:
-		Buffer(char* ptr, size_t contentSize, Callback callback);
+		Buffer();
+		Buffer(Buffer&& rhs);
+		Buffer& operator=(Buffer&& rhs);
 		~Buffer();
+		bool valid() const;
 		char* data();
+		const char* data() const;
 		size_t size() const;
 		void resize(size_t contentSize);
+		void reset();
 
 	private:
+		friend class MemPool;
+		Buffer(MemPool* pool, uint32_t index, char* ptr, size_t contentSize);
 		Buffer(const Buffer&);
 		const Buffer& operator=(const Buffer&);
 
+		MemPool* pool;
+		uint32_t index;
 		char* ptr;
 		size_t contentSize;
-		Callback callback;
 	};
 
 private:
-	typedef std::vector<char> Element;
+	MemPool(const MemPool&);
+	const MemPool& operator=(const MemPool&);
+
+	void allocArena(const Policy& policy);
+	void freeArena();
+	unsigned nodeOf(uint32_t index) const;
+	uint32_t pop();
+	uint32_t pop(unsigned node);
+	void push(uint32_t index);
+	void release(uint32_t index);
+	Buffer makeBuffer(uint32_t index);
 
 	std::atomic<bool> stop;
-	mutable std::mutex mut;
-	std::condition_variable cond;
+	const size_t elementSize;
+	const size_t elementCount;
+	size_t stride;
+	unsigned nNode;
+	char* arena;
+	size_t arenaSize;
 
-	std::stack<int> freeIndexStack;
-	std::vector<Element> elements;
+	std::unique_ptr<std::atomic<uint64_t>[]> freeHeads;
+	std::unique_ptr<std::atomic<uint32_t>[]> freeNext;
+	std::atomic<int> waiters;
+	std::mutex mut;
+	std::condition_variable cond;
 };
 
 } // namespace Lz4Mt
@@ -0,0 +1,105 @@
+#include <cassert>
+#include <mutex>
+#include <vector>
+#include "lz4mt_compat.h"
+#include "lz4mt_threadpool.h"
+
+namespace {
+typedef std::unique_lock<std::mutex> Lock;
+} // anonymous namespace
+
+
+namespace Lz4Mt {
+
+ThreadPool::ThreadPool(unsigned nThread, size_t queueCapacity, uint64_t affinityMask)
+	: stop(false)
+	, mut()
+	, condPush()
+	, condPop()
+	, condIdle()
+	, queue()
+	, running(0)
+	, queueCapacity(queueCapacity ? queueCapacity : 1)
+	, threads()
+{
+	threads.reserve(nThread);
+	for(unsigned i = 0; i < nThread; ++i) {
+		threads.emplace_back(&ThreadPool::worker, this, i, affinityMask);
+	}
+}
+
+
+ThreadPool::~ThreadPool() {
+	{
+		Lock lock(mut);
+		stop = true;
+	}
+	condPop.notify_all();
+	condPush.notify_all();
+	for(auto& t : threads) {
+		t.join();
+	}
+}
+
+
+void ThreadPool::submit(Task task) {
+	if(threads.empty()) {
+		task(0);
+		return;
+	}
+
+	{
+		Lock lock(mut);
+		while(!stop && queue.size() >= queueCapacity) {
+			condPush.wait(lock);
+		}
+		assert(!stop);
+		queue.push_back(std::move(task));
+	}
+	condPop.notify_one();
+}
+
+
+void ThreadPool::wait() {
+	Lock lock(mut);
+	while(!queue.empty() || running) {
+		condIdle.wait(lock);
+	}
+}
+
+
+unsigned ThreadPool::size() const {
+	return static_cast<unsigned>(threads.size());
+}
+
+
+void ThreadPool::worker(unsigned index, uint64_t affinityMask) {
+	if(affinityMask) {
+		setCurrentThreadAffinity(affinityMask);
+	}
+	for(;;) {
+		Task task;
+		{
+			Lock lock(mut);
+			while(!stop && queue.empty()) {
+				condPop.wait(lock);
+			}
+			if(queue.empty()) {
+				return;
+			}
+			task = std::move(queue.front());
+			queue.pop_front();
+			++running;
+		}
+		condPush.notify_one();
+		task(index);
+		task = nullptr;
+		{
+			Lock lock(mut);
+			--running;
+		}
+		condIdle.notify_all();
+	}
+}
+
+} // namespace Lz4Mt
@@ -0,0 +1,51 @@
+#ifndef LZ4MT_THREADPOOL_H
+#define LZ4MT_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Lz4Mt {
+
+///	Fixed size worker pool with a bounded FIFO task queue.
+///
+///	Tasks are started in submission order.  submit() blocks while the
+///	queue is full.  A pool of zero threads runs every task inline, in the
+///	calling thread.  A task gets the index of the worker which runs it,
+///	in [0, size()), or 0 when it runs inline.  Workers are bound to the
+///	CPUs of affinityMask (bit i : CPU i) when it is not 0.  wait() returns
+///	once every task submitted has returned.
+class ThreadPool {
+public:
+	typedef std::function<void(unsigned)> Task;
+
+	ThreadPool(unsigned nThread, size_t queueCapacity, uint64_t affinityMask = 0);
+	~ThreadPool();
+	void submit(Task task);
+	void wait();
+	unsigned size() const;
+
+private:
+	ThreadPool(const ThreadPool&);
+	const ThreadPool& operator=(const ThreadPool&);
+
+	void worker(unsigned index, uint64_t affinityMask);
+
+	bool stop;
+	mutable std::mutex mut;
+	std::condition_variable condPush;
+	std::condition_variable condPop;
+	std::condition_variable condIdle;
+	std::deque<Task> queue;
+	unsigned running;
+	size_t queueCapacity;
+	std::vector<std::thread> threads;
+};
+
+} // namespace Lz4Mt
+
+#endif // LZ4MT_THREADPOOL_H
@@ -1,8 +1,13 @@
 #ifndef LZ4MT_XXH32_H
 #define LZ4MT_XXH32_H
 
+#include <cstdint>
+#include <memory>
+
 namespace Lz4Mt {
 
+///	Incremental XXH32.  Not synchronized : a stream hash has one owner at
+///	a time, which is the ordered stage that feeds it blocks in order.
 class Xxh32 {
 public:
 	Xxh32(uint32_t seed);
@@ -12,7 +17,9 @@ public:
 	uint32_t digest();
 
 private:
-	mutable std::mutex mut;
+	Xxh32(const Xxh32&);
+	const Xxh32& operator=(const Xxh32&);
+
 	std::unique_ptr<char[]> st;
 };
 
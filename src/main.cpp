@@ -1,12 +1,18 @@
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <string>
 #include <string.h>
 #include <vector>
 #include <algorithm>
 #include <deque>
 #include <cctype>
+#include <cstdlib>
+#include <mutex>
 #if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -18,11 +24,147 @@
 #include "lz4hc.h"
 #include "lz4mt.h"
 #include "lz4mt_benchmark.h"
+#include "lz4mt_compat.h"
+#include "lz4mt_io_async.h"
 #include "lz4mt_io_cstdio.h"
+#include "lz4mt_io_mmap.h"
+#include "lz4mt_threadpool.h"
+#include "lz4mt_xxh32.h"
 
 
 namespace {
 
+// A worker state is its compression level, followed by the LZ4 or LZ4HC
+// state.  Levels 1 to 3 accelerate the fast compressor, 4 to 9 are the
+// match attempts of LZ4HC; 0 is the default of the fast compressor.  The
+// level of each block picks the compressor, see --lz4mt-adaptive.
+const size_t stateHeaderSize = 16;
+const int minLevelHC = 4;
+const int defaultLevelHC = 9;
+
+int getLevel(const void* state) {
+	int level = 0;
+	memcpy(&level, state, sizeof(level));
+	return level;
+}
+
+bool isHC(const void* state) {
+	return getLevel(state) >= minLevelHC;
+}
+
+void* getLz4State(void* state) {
+	return static_cast<char*>(state) + stateHeaderSize;
+}
+
+int getAcceleration(const void* state) {
+	const auto level = getLevel(state);
+	return (level > 0 && level < 3) ? 1 << (3 - level) : 1;
+}
+
+void* createState(int level) {
+	const auto size = (level >= minLevelHC)
+		? LZ4_sizeofStateHC()
+		: std::max(LZ4_sizeofState(), LZ4_sizeofStreamState());
+	auto* state = static_cast<char*>(malloc(stateHeaderSize + size));
+	if(state) {
+		memcpy(state, &level, sizeof(level));
+	}
+	return state;
+}
+
+void freeState(void* state) {
+	free(state);
+}
+
+// A state which could not be created, or reset, fails the block : stored
+// raw, it would hide the error.
+const int compressFail = -1;
+
+int compressWithState(void* state, const char* src, char* dst, int isize, int maxOutputSize) {
+	if(!state) {
+		return compressFail;
+	}
+	if(isHC(state)) {
+		return LZ4_compressHC2_limitedOutput_withStateHC(
+			getLz4State(state), src, dst, isize, maxOutputSize, getLevel(state));
+	}
+	return LZ4_compress_fast_withState(
+		getLz4State(state), src, dst, isize, maxOutputSize, getAcceleration(state));
+}
+
+int compressWithPrefix(void* state, const char* src, char* dst, int prefixSize, int isize, int maxOutputSize) {
+	if(!state) {
+		return compressFail;
+	}
+	auto* lz4 = getLz4State(state);
+	if(isHC(state)) {
+		if(   0 != LZ4_resetStreamStateHC(lz4, src - prefixSize)
+		   || 0 != LZ4_loadPrefixHC(lz4, prefixSize)
+		) {
+			return compressFail;
+		}
+		return LZ4_compressHC2_limitedOutput_continue(
+			lz4, src, dst, isize, maxOutputSize, getLevel(state));
+	}
+	if(   0 != LZ4_resetStreamState(lz4, src - prefixSize)
+	   || 0 != LZ4_loadPrefix(lz4, prefixSize)
+	) {
+		return compressFail;
+	}
+	return LZ4_compress_fast_continue(
+		lz4, src, dst, isize, maxOutputSize, getAcceleration(state));
+}
+
+// A dictionary is hashed for both compressors.
+struct DictionaryState {
+	void* lz4;
+	void* lz4hc;
+};
+
+void freeDictionary(void* dictState) {
+	auto* d = static_cast<DictionaryState*>(dictState);
+	if(d->lz4) {
+		LZ4_free(d->lz4);
+	}
+	if(d->lz4hc) {
+		LZ4_freeHC(d->lz4hc);
+	}
+	delete d;
+}
+
+void* createDictionary(const char* dict, int dictSize) {
+	auto* d = new DictionaryState;
+	d->lz4 = LZ4_create(dict);
+	d->lz4hc = LZ4_createHC(dict);
+	if(   !d->lz4 || 0 != LZ4_loadPrefix(d->lz4, dictSize)
+	   || !d->lz4hc || 0 != LZ4_loadPrefixHC(d->lz4hc, dictSize)
+	) {
+		freeDictionary(d);
+		d = nullptr;
+	}
+	return d;
+}
+
+int compressWithDictionary(void* state, const void* dictState, const char* src, char* dst, int dictSize, int isize, int maxOutputSize) {
+	if(!state) {
+		return compressFail;
+	}
+	const auto* d = static_cast<const DictionaryState*>(dictState);
+	auto* lz4 = getLz4State(state);
+	if(isHC(state)) {
+		if(0 != LZ4_copyStreamStateHC(lz4, d->lz4hc, src - dictSize)) {
+			return compressFail;
+		}
+		return LZ4_compressHC2_limitedOutput_continue(
+			lz4, src, dst, isize, maxOutputSize, getLevel(state));
+	}
+	if(0 != LZ4_copyStreamState(lz4, d->lz4, src - dictSize)) {
+		return compressFail;
+	}
+	return LZ4_compress_fast_continue(
+		lz4, src, dst, isize, maxOutputSize, getAcceleration(state));
+}
+
 const char LZ4MT_EXTENSION[] = ".lz4";
 const char LZ4MT_UNLZ4[] = "unlz4";
 const char LZ4MT_LZ4CAT[] = "lz4cat";
@@ -33,6 +175,8 @@ const char usage[] =
 	"switch :\n"
 	"  -c0/-c  : Compress (lz4) (default)\n"
 	"  -c1/-hc : Compress (lz4hc)\n"
+	"  -1..-9  : Compression level, fast (1-3, -3 = -c0) to lz4hc"
+	             " (4-9, -9 = -c1)\n"
 	"  -d      : Decompress\n"
 	"  -y      : Overwrite without prompting\n"
 	"  -H      : Help (this text + advanced options)\n"
@@ -42,17 +186,46 @@ const char usage_advanced[] =
 	"\nAdvanced options :\n"
 	" -t       : decode test mode (do not output anything)\n"
 	" -B#      : Block size [4-7](default : 7)\n"
+	" -BD      : Block dependency (improve compression ratio)\n"
 	" -BX      : enable block checksum (default:disabled)\n"
 	" -Sx      : disable stream checksum (default:enabled)\n"
 	" -b#      : benchmark files, using # [0-1] compression level\n"
 	" -i#      : iteration loops [1-9](default : 3), benchmark mode"
 	             " only\n"
+	" -m       : multiple input files (outputs : input names + .lz4, or"
+	             " without .lz4)\n"
+	" -r       : operate recursively on directories (implies -m)\n"
 	"  input   : can be 'stdin' (pipe) or a filename\n"
 	"  output  : can be 'stdout'(pipe) or a filename or 'null'\n"
 
 	"\nlz4mt exclusive options :\n"
 	" --lz4mt-thread=0 : Multi thread mode (default)\n"
 	" --lz4mt-thread=1 : Single thread mode\n"
+	" --lz4mt-workers=N : Worker threads (default : number of CPUs)\n"
+	" --lz4mt-depth=N : Blocks in flight (default : workers + 1)\n"
+	" --lz4mt-affinity=LIST : Run on these CPUs only (e.g. 0-3,8)\n"
+	" --lz4mt-shared[=MB] : Streams share one set of workers and at most MB"
+	                       " of buffers (-m : every file at once)\n"
+	" --lz4mt-huge-pages : Allocate block buffers on huge pages\n"
+	" --lz4mt-dict=FILE : Preset dictionary (dictId : XXH32 of FILE)\n"
+	" --lz4mt-mmap : Memory mapped file I/O\n"
+	" --lz4mt-async : Read ahead and write behind on I/O threads\n"
+	" --lz4mt-direct : --lz4mt-async, bypassing the page cache (O_DIRECT)\n"
+	" --lz4mt-stream-size : Store input file size in the stream header\n"
+	" --lz4mt-seek-table : Append a seek table to the stream\n"
+	" --lz4mt-probe : Store high entropy blocks without compressing them\n"
+	" --lz4mt-split[=B#] : Cut slow stretches into blocks of -B# (default 4)\n"
+	" --lz4mt-adaptive[=#] : Compress at level # (default 9) while I/O is"
+	                        " slower than the workers\n"
+	" --lz4mt-block-index : Decompress blocks of a seekable file in parallel\n"
+	" --lz4mt-trusted : Decompress without input bounds checks"
+	                   " (only for files lz4mt wrote)\n"
+	" --lz4mt-stats : Show pipeline timings and counters\n"
+	" --lz4mt-range=OFFSET,SIZE : Decompress SIZE bytes from OFFSET"
+	                              " (needs a seek table, inside the content)\n"
+	" --lz4mt-bench-threads=LIST : benchmark thread counts (e.g. 1,2,4 or 1-8)\n"
+	" --lz4mt-bench-blocks=LIST : benchmark block sizes (e.g. 4-7)\n"
+	" --lz4mt-bench-format=FMT : benchmark output : text, csv or json\n"
 ;
 
 typedef std::function<bool(void)> AttyFunc;
@@ -72,11 +245,30 @@ struct Option {
 		: error(false)
 		, exitFlag(false)
 		, compMode(CompMode::COMPRESS_C0)
+		, level(0)
+		, adaptiveLevel(0)
 		, sd(lz4mtInitStreamDescriptor())
 		, mode(LZ4MT_MODE_DEFAULT)
 		, inpFilename()
 		, outFilename()
+		, inpFilenames()
+		, dictFilename()
 		, nullWrite(false)
+		, mmapIo(false)
+		, asyncIo(false)
+		, directIo(false)
+		, storeStreamSize(false)
+		, range(false)
+		, rangeOffset(0)
+		, rangeSize(0)
+		, batch(false)
+		, recursive(false)
+		, stats(false)
+		, threadCount(0)
+		, poolDepth(0)
+		, affinityMask(0)
+		, shared(false)
+		, sharedMemoryLimit(0)
 		, overwrite(false)
 		, silence(false)
 		, benchmark()
@@ -96,6 +288,10 @@ struct Option {
 			args.push_back(argv[iarg]);
 		}
 
+		// Positional arguments, assigned once every switch is known.
+		// "-" stands for stdin or stdout.
+		std::vector<std::string> files;
+
 		auto isDigits = [](const std::string& s) {
 			return std::all_of(std::begin(s), std::end(s)
 							   , static_cast<int(*)(int)>(std::isdigit));
@@ -148,6 +344,228 @@ struct Option {
 			}
 		};
 
+		opts["--lz4mt-huge-pages"] = [&](const std::string&) -> bool {
+			mode |= LZ4MT_MODE_HUGE_PAGES;
+			return true;
+		};
+
+		opts["--lz4mt-dict"] = [&](const std::string& arg) -> bool {
+			dictFilename = getOptionArg(arg);
+			if(dictFilename.empty()) {
+				errorString += "lz4mt: Bad argument for --lz4mt-dict\n";
+				return false;
+			}
+			return true;
+		};
+
+		opts["--lz4mt-mmap"] = [&](const std::string&) -> bool {
+			mmapIo = true;
+			asyncIo = false;
+			return true;
+		};
+
+		opts["--lz4mt-async"] = [&](const std::string&) -> bool {
+			mmapIo = false;
+			asyncIo = true;
+			return true;
+		};
+
+		opts["--lz4mt-direct"] = [&](const std::string&) -> bool {
+			mmapIo = false;
+			asyncIo = true;
+			directIo = true;
+			return true;
+		};
+
+		opts["--lz4mt-stream-size"] = [&](const std::string&) -> bool {
+			storeStreamSize = true;
+			return true;
+		};
+
+		opts["--lz4mt-probe"] = [&](const std::string&) -> bool {
+			sd.probe.sampleSize = 4096;
+			return true;
+		};
+
+		opts["--lz4mt-adaptive"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			if(a.empty()) {
+				adaptiveLevel = defaultLevelHC;
+			} else if(1 == a.size() && a[0] >= '1' && a[0] <= '9') {
+				adaptiveLevel = a[0] - '0';
+			} else {
+				errorString += "lz4mt: Bad argument for --lz4mt-adaptive ["
+							   + a + "]\n";
+				return false;
+			}
+			return true;
+		};
+
+		opts["--lz4mt-split"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			if(a.empty()) {
+				sd.split.blockMaximumSize = 4;
+			} else if(1 == a.size() && a[0] >= '4' && a[0] <= '6') {
+				sd.split.blockMaximumSize = static_cast<char>(a[0] - '0');
+			} else {
+				errorString += "lz4mt: Bad argument for --lz4mt-split ["
+							   + a + "]\n";
+				return false;
+			}
+			return true;
+		};
+
+		opts["--lz4mt-stats"] = [&](const std::string&) -> bool {
+			stats = true;
+			return true;
+		};
+
+		opts["--lz4mt-seek-table"] = [&](const std::string&) -> bool {
+			mode |= LZ4MT_MODE_SEEK_TABLE;
+			return true;
+		};
+
+		opts["--lz4mt-block-index"] = [&](const std::string&) -> bool {
+			mode |= LZ4MT_MODE_BLOCK_INDEX;
+			return true;
+		};
+
+		opts["--lz4mt-trusted"] = [&](const std::string&) -> bool {
+			mode |= LZ4MT_MODE_TRUSTED;
+			return true;
+		};
+
+		// "1,2,4" or "1-8", every value in [lo, hi]
+		auto getList = [&](const std::string& arg, int lo, int hi
+						   , std::vector<int>& list) -> bool
+		{
+			const auto a = getOptionArg(arg);
+			std::vector<int> v;
+			for(size_t pos = 0; pos <= a.size(); ) {
+				auto end = a.find(',', pos);
+				if(std::string::npos == end) {
+					end = a.size();
+				}
+				const auto e = a.substr(pos, end - pos);
+				const auto dash = e.find('-');
+				const auto e0 = e.substr(0, dash);
+				const auto e1 = std::string::npos != dash ? e.substr(dash+1) : e0;
+				if(e0.empty() || e1.empty() || !isDigits(e0) || !isDigits(e1)) {
+					v.clear();
+					break;
+				}
+				const auto v0 = atoi(e0.c_str());
+				const auto v1 = atoi(e1.c_str());
+				if(v0 < lo || v1 > hi || v0 > v1) {
+					v.clear();
+					break;
+				}
+				for(int x = v0; x <= v1; ++x) {
+					v.push_back(x);
+				}
+				pos = end + 1;
+			}
+			if(v.empty()) {
+				errorString += "lz4mt: Bad argument for " + getOptionName(arg)
+							   + " [" + a + "]\n";
+				return false;
+			}
+			list = v;
+			return true;
+		};
+
+		opts["--lz4mt-bench-threads"] = [&](const std::string& arg) -> bool {
+			std::vector<int> v;
+			if(!getList(arg, 0, 1024, v)) {
+				return false;
+			}
+			benchmark.threadCounts.assign(v.begin(), v.end());
+			return true;
+		};
+
+		opts["--lz4mt-bench-blocks"] = [&](const std::string& arg) -> bool {
+			return getList(arg, 4, 7, benchmark.blockSizes);
+		};
+
+		opts["--lz4mt-bench-format"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			if("text" == a) {
+				benchmark.format = Lz4Mt::Benchmark::Format::TEXT;
+			} else if("csv" == a) {
+				benchmark.format = Lz4Mt::Benchmark::Format::CSV;
+			} else if("json" == a) {
+				benchmark.format = Lz4Mt::Benchmark::Format::JSON;
+			} else {
+				errorString += "lz4mt: Bad argument for --lz4mt-bench-format ["
+							   + a + "]\n";
+				return false;
+			}
+			return true;
+		};
+
+		opts["--lz4mt-workers"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			if(a.empty() || !isDigits(a) || a.size() > 4) {
+				errorString += "lz4mt: Bad argument for --lz4mt-workers ["
+							   + a + "]\n";
+				return false;
+			}
+			threadCount = static_cast<unsigned>(atoi(a.c_str()));
+			mode &= ~LZ4MT_MODE_SEQUENTIAL;
+			return true;
+		};
+
+		opts["--lz4mt-depth"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			if(a.empty() || !isDigits(a) || a.size() > 4) {
+				errorString += "lz4mt: Bad argument for --lz4mt-depth ["
+							   + a + "]\n";
+				return false;
+			}
+			poolDepth = static_cast<unsigned>(atoi(a.c_str()));
+			return true;
+		};
+
+		opts["--lz4mt-affinity"] = [&](const std::string& arg) -> bool {
+			std::vector<int> cpus;
+			if(!getList(arg, 0, 63, cpus)) {
+				return false;
+			}
+			affinityMask = 0;
+			for(const auto cpu : cpus) {
+				affinityMask |= uint64_t(1) << cpu;
+			}
+			return true;
+		};
+
+		opts["--lz4mt-shared"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			if(!isDigits(a) || a.size() > 9) {
+				errorString += "lz4mt: Bad argument for --lz4mt-shared ["
+							   + a + "]\n";
+				return false;
+			}
+			shared = true;
+			sharedMemoryLimit = strtoull(a.c_str(), nullptr, 10) << 20;
+			return true;
+		};
+
+		opts["--lz4mt-range"] = [&](const std::string& arg) -> bool {
+			const auto a = getOptionArg(arg);
+			const auto pos = a.find(',');
+			const auto o = a.substr(0, pos);
+			const auto n = std::string::npos != pos ? a.substr(pos+1) : "";
+			if(o.empty() || n.empty() || !isDigits(o) || !isDigits(n)) {
+				errorString += "lz4mt: Bad argument for --lz4mt-range ["
+							   + a + "]\n";
+				return false;
+			}
+			range = true;
+			rangeOffset = strtoull(o.c_str(), nullptr, 10);
+			rangeSize = strtoull(n.c_str(), nullptr, 10);
+			return true;
+		};
+
 		while(!args.empty() && !error && !exitFlag) {
 			const auto a = args.front();
 			args.pop_front();
@@ -159,21 +577,11 @@ struct Option {
 			} else if('-' != a0) {
 				if(benchmark.enable) {
 					benchmark.files.push_back(a);
-				} else if(inpFilename.empty()) {
-					inpFilename = a;
-				} else if(outFilename.empty()) {
-					outFilename = a;
 				} else {
-					errorString += "lz4mt: Bad argument ["
-								   + std::string(a) + "]\n";
-					error = true;
+					files.push_back(a);
 				}
 			} else if('-' == a0 && 0 == a1) {
-				if(inpFilename.empty()) {
-					inpFilename = stdinFilename;
-				} else {
-					outFilename = stdoutFilename;
-				}
+				files.push_back(a);
 			} else if('-' == a0 && '-' == a1) {
 				//	long option
 				const auto it = findOption(a);
@@ -213,14 +621,21 @@ struct Option {
 					if(getif('H')) {						// -H
 						showUsage(true);
 						exitFlag = true;
+					} else if(a[i] >= '1' && a[i] <= '9') {	// -[1-9]
+						level = a[i++] - '0';
+						compMode = (level < minLevelHC) ? CompMode::COMPRESS_C0
+														: CompMode::COMPRESS_C1;
 					} else if(getif2('c', '0')) {			// -c0
 						compMode = CompMode::COMPRESS_C0;
+						level = 0;
 					} else if(getif2('c', '1')) {			// -c1
 						compMode = CompMode::COMPRESS_C1;
+						level = defaultLevelHC;
 					} else if(getif('c')) {					// -c?
 						// NOTE: no bad usage
 					} else if(getif2('h', 'c')) {			// -hc
 						compMode = CompMode::COMPRESS_C1;
+						level = defaultLevelHC;
 					} else if(getif('h')) {					// -h?
 						showUsage(true);
 						exitFlag = true;
@@ -239,8 +654,8 @@ struct Option {
 								sd.bd.blockMaximumSize = 6;
 							} else if(getif('7')) {			// -B7
 								sd.bd.blockMaximumSize = 7;
-//							} else if(getif('D')) {			// -BD
-//								// TODO : Implement
+							} else if(getif('D')) {			// -BD
+								sd.flg.blockIndependence = 0;
 							} else if(getif('X')) {			// -BX
 								sd.flg.blockChecksum = 1;
 							} else {						// -B?
@@ -255,9 +670,11 @@ struct Option {
 						error = true;
 					} else if(getif2('b', '0')) {			// -b0
 						compMode = CompMode::COMPRESS_C0;
+						level = 0;
 						benchmark.enable = true;
 					} else if(getif2('b', '1')) {			// -b1
 						compMode = CompMode::COMPRESS_C1;
+						level = defaultLevelHC;
 						benchmark.enable = true;
 					} else if(getif('b')) {					// -b?
 						// NOTE: no bad usage
@@ -272,6 +689,11 @@ struct Option {
 						// NOTE: no bad usage
 					} else if(getif('y')) {					// -y
 						overwrite = true;
+					} else if(getif('m')) {					// -m
+						batch = true;
+					} else if(getif('r')) {					// -r
+						batch = true;
+						recursive = true;
 //					} else if(getif('p')) {					// -p
 //						// Pause at the end (benchmark only)
 //						// (hidden option)
@@ -288,7 +710,49 @@ struct Option {
 			}
 		}
 
-		if(!error && !exitFlag) {
+		// smaller blocks than the frame's only
+		if(!error && sd.split.blockMaximumSize
+		   && sd.split.blockMaximumSize >= sd.bd.blockMaximumSize) {
+			errorString += "lz4mt: Bad argument for --lz4mt-split ["
+						   + std::to_string(static_cast<int>(sd.split.blockMaximumSize))
+						   + "] : not smaller than -B"
+						   + std::to_string(static_cast<int>(sd.bd.blockMaximumSize))
+						   + "\n";
+			error = true;
+		}
+
+		if(!error && !exitFlag && batch) {
+			for(const auto& f : files) {
+				if("-" == f || cmpFilename(stdinFilename, f)) {
+					errorString += "lz4mt: stdin can't be used with -m\n";
+					error = true;
+					break;
+				}
+			}
+			if(files.empty()) {
+				errorString += "lz4mt: No input files\n";
+				error = true;
+			}
+			inpFilenames = files;
+			nullWrite = cmpFilename(nullFilename, outFilename);
+		}
+
+		if(!error && !exitFlag && !batch) {
+			for(const auto& f : files) {
+				const bool dash = "-" == f;
+				if(inpFilename.empty()) {
+					inpFilename = dash ? stdinFilename : f;
+				} else if(outFilename.empty()) {
+					outFilename = dash ? stdoutFilename : f;
+				} else {
+					errorString += "lz4mt: Bad argument [" + f + "]\n";
+					error = true;
+					break;
+				}
+			}
+		}
+
+		if(!error && !exitFlag && !batch) {
 			if(inpFilename.empty()) {
 				inpFilename = stdinFilename;
 			}
@@ -388,11 +852,30 @@ struct Option {
 	bool error;
 	bool exitFlag;
 	CompMode compMode;
+	int level;
+	int adaptiveLevel;
 	Lz4MtStreamDescriptor sd;
 	int mode;
 	std::string inpFilename;
 	std::string outFilename;
+	std::vector<std::string> inpFilenames;
+	std::string dictFilename;
 	bool nullWrite;
+	bool mmapIo;
+	bool asyncIo;
+	bool directIo;
+	bool storeStreamSize;
+	bool range;
+	uint64_t rangeOffset;
+	uint64_t rangeSize;
+	bool batch;
+	bool recursive;
+	bool stats;
+	unsigned threadCount;
+	unsigned poolDepth;
+	uint64_t affinityMask;
+	bool shared;
+	uint64_t sharedMemoryLimit;
 	bool overwrite;
 	bool silence;
 	Lz4Mt::Benchmark benchmark;
@@ -400,6 +883,239 @@ struct Option {
 };
 
 
+struct FileIo {
+	FileIo(bool mmapIo, bool asyncIo)
+		: openI (Lz4Mt::Cstdio::openIstream)
+		, openO (Lz4Mt::Cstdio::openOstream)
+		, closeI(Lz4Mt::Cstdio::closeIstream)
+		, closeO(Lz4Mt::Cstdio::closeOstream)
+	{
+		if(mmapIo) {
+			openI	= Lz4Mt::Mmap::openIstream;
+			openO	= Lz4Mt::Mmap::openOstream;
+			closeI	= Lz4Mt::Mmap::closeIstream;
+			closeO	= Lz4Mt::Mmap::closeOstream;
+		} else if(asyncIo) {
+			openI	= Lz4Mt::Async::openIstream;
+			openO	= Lz4Mt::Async::openOstream;
+			closeI	= Lz4Mt::Async::closeIstream;
+			closeO	= Lz4Mt::Async::closeOstream;
+		}
+	}
+
+	bool (*openI)(Lz4MtContext*, const std::string&);
+	bool (*openO)(Lz4MtContext*, const std::string&, bool);
+	void (*closeI)(Lz4MtContext*);
+	void (*closeO)(Lz4MtContext*);
+};
+
+
+Lz4MtResult processStream(Option& opt, Lz4MtContext* ctx, Lz4MtStreamDescriptor* sd) {
+	if(opt.isCompress()) {
+		return lz4mtCompress(ctx, sd);
+	} else if(opt.isDecompress()) {
+		if(opt.range) {
+			return lz4mtDecompressRange(ctx, sd, opt.rangeOffset, opt.rangeSize);
+		}
+		return lz4mtDecompress(ctx, sd);
+	} else {
+		opt.display("lz4mt: You must specify a switch -c or -d\n");
+		return LZ4MT_RESULT_BAD_ARG;
+	}
+}
+
+
+bool hasLz4Extension(const std::string& filename) {
+	const auto n = strlen(LZ4MT_EXTENSION);
+	return filename.size() > n
+		&& 0 == filename.compare(filename.size() - n, n, LZ4MT_EXTENSION);
+}
+
+
+struct BatchFile {
+	BatchFile()
+		: inpFilename()
+		, outFilename()
+		, size(0)
+	{}
+
+	std::string inpFilename;
+	std::string outFilename;
+	uint64_t size;
+};
+
+
+//	-m / -r : every input gets its own stream, named like the single file
+//	mode does.  Files too small to keep the workers busy on their own run
+//	concurrently, one single threaded stream per worker; the larger ones
+//	follow one at a time, each with all the workers.
+int lz4mtBatch(Option& opt, const Lz4MtContext& ctx, const FileIo& io) {
+	using namespace Lz4Mt::Cstdio;
+
+	std::mutex mutDisplay;
+	bool failed = false;
+	const auto report = [&](const std::string& message) {
+		std::unique_lock<std::mutex> lock(mutDisplay);
+		failed = true;
+		opt.display(message);
+	};
+
+	// name, found by walking a directory
+	std::deque<std::pair<std::string, bool>> names;
+	for(const auto& f : opt.inpFilenames) {
+		names.push_back(std::make_pair(f, false));
+	}
+
+	std::vector<BatchFile> files;
+	while(!names.empty()) {
+		const auto name = names.front().first;
+		const auto walked = names.front().second;
+		names.pop_front();
+
+		if(isDirectory(name)) {
+			if(!opt.recursive) {
+				report("lz4mt: [" + name + "] is a directory (use -r)\n");
+				continue;
+			}
+			const auto entries = listDirectory(name);
+			for(auto it = entries.rbegin(); it != entries.rend(); ++it) {
+				names.push_front(std::make_pair(*it, true));
+			}
+			continue;
+		}
+
+		// Inside a directory, only take what this mode can handle.
+		const auto lz4 = hasLz4Extension(name);
+		if(walked && lz4 == opt.isCompress()) {
+			continue;
+		}
+
+		BatchFile b;
+		b.inpFilename = name;
+		b.size = getFilesize(name);
+		if(opt.nullWrite) {
+			b.outFilename = getNullFilename();
+		} else if(opt.isCompress()) {
+			b.outFilename = name + LZ4MT_EXTENSION;
+		} else if(lz4) {
+			b.outFilename = name.substr(0, name.size() - strlen(LZ4MT_EXTENSION));
+		} else {
+			report("lz4mt: Cannot automatically decide an output filename for ["
+				   + name + "]\n");
+			continue;
+		}
+
+		if(!opt.nullWrite && !opt.overwrite && fileExist(b.outFilename)) {
+			report("lz4mt: " + b.outFilename + " already exists\n");
+			continue;
+		}
+		files.push_back(b);
+	}
+
+	const auto process = [&](const BatchFile& b, bool sequential) {
+		auto c = ctx;
+		if(sequential) {
+			c.mode = static_cast<Lz4MtMode>(c.mode | LZ4MT_MODE_SEQUENTIAL);
+		}
+		auto sd = opt.sd;
+		if(opt.storeStreamSize && opt.isCompress() && b.size) {
+			sd.flg.streamSize = 1;
+			sd.streamSize = b.size;
+		}
+		if(!io.openI(&c, b.inpFilename)) {
+			report("lz4mt: Can't open input file [" + b.inpFilename + "]\n");
+			return;
+		}
+		if(!io.openO(&c, b.outFilename, opt.nullWrite)) {
+			io.closeI(&c);
+			report("lz4mt: Can't open output file [" + b.outFilename + "]\n");
+			return;
+		}
+		const auto e = processStream(opt, &c, &sd);
+		io.closeO(&c);
+		io.closeI(&c);
+		if(LZ4MT_RESULT_OK != e) {
+			report("lz4mt: " + b.inpFilename + " : "
+				   + std::string(lz4mtResultToString(e)) + "\n");
+		}
+	};
+
+	const unsigned nThread = [&]() -> unsigned {
+		if(0 != (ctx.mode & LZ4MT_MODE_SEQUENTIAL)) {
+			return 0;
+		} else if(ctx.threadCount) {
+			return ctx.threadCount;
+		} else {
+			return Lz4Mt::getHardwareConcurrency();
+		}
+	} ();
+	const uint64_t blockSize = 1 << (8 + 2 * opt.sd.bd.blockMaximumSize);
+	// With a shared executor, every file runs at once on the same workers.
+	const bool shared = nullptr != ctx.executor;
+	const auto isLarge = [&](const BatchFile& b) {
+		return !shared && nThread > 1 && b.size >= blockSize * nThread;
+	};
+
+	{
+		Lz4Mt::ThreadPool pool(nThread, 2 * nThread, ctx.affinityMask);
+		for(const auto& b : files) {
+			if(!isLarge(b)) {
+				pool.submit([&process, &b, shared](unsigned) {
+					process(b, !shared);
+				});
+			}
+		}
+	}
+
+	for(const auto& b : files) {
+		if(isLarge(b)) {
+			process(b, false);
+		}
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+void showStats(const Lz4MtStats& s) {
+	const auto ms = [](uint64_t ns) {
+		return static_cast<double>(ns) / 1000000.0;
+	};
+	std::cerr
+		<< std::fixed << std::setprecision(3)
+		<< "lz4mt: stats (ms, summed over threads)\n"
+		<< "  read         : " << ms(s.readNs) << "\n"
+		<< "  window wait  : " << ms(s.windowWaitNs) << "\n"
+		<< "  alloc wait   : " << ms(s.allocWaitNs) << "\n"
+		<< "  codec        : " << ms(s.codecNs) << "\n"
+		<< "  order wait   : " << ms(s.orderWaitNs) << "\n"
+		<< "  write        : " << ms(s.writeNs) << "\n"
+		<< "  hash         : " << ms(s.hashNs) << "\n"
+		<< "  blocks       : " << s.blocks
+		<< " (" << s.incompressibleBlocks << " incompressible, "
+		<< s.adaptiveBlocks << " at the adaptive level)\n"
+		<< "  alloc stalls : " << s.allocStalls << "\n"
+		<< "  max in flight: " << s.maxInFlight << "\n"
+		<< "  bytes in     : " << s.bytesIn << "\n"
+		<< "  bytes out    : " << s.bytesOut << "\n"
+		<< "lz4mt: block latency (ms, upper bound) p50 / p90 / p99 / max\n"
+	;
+	const auto latency = [&](const char* name, const Lz4MtHistogram& h) {
+		std::cerr << name;
+		const double ps[] = { 50.0, 90.0, 99.0, 100.0 };
+		const char* sep = "";
+		for(const auto p : ps) {
+			std::cerr << sep << ms(lz4mtHistogramPercentile(&h, p));
+			sep = " / ";
+		}
+		std::cerr << "\n";
+	};
+	latency("  coded        : ", s.codedLatency);
+	latency("  written      : ", s.writtenLatency);
+	latency("  blocked      : ", s.blockedLatency);
+}
+
+
 int lz4mtCommandLine(int argc, char* argv[]) {
 	using namespace Lz4Mt::Cstdio;
 	Option opt(argc, argv
@@ -421,26 +1137,101 @@ int lz4mtCommandLine(int argc, char* argv[]) {
 
 	Lz4MtContext ctx = lz4mtInitContext();
 	ctx.mode			= static_cast<Lz4MtMode>(opt.mode);
+	ctx.level			= opt.level;
+	ctx.adaptiveLevel	= opt.adaptiveLevel;
+	ctx.threadCount		= opt.threadCount;
+	ctx.poolDepth		= opt.poolDepth;
+	ctx.affinityMask	= opt.affinityMask;
 	ctx.read			= read;
 	ctx.readSeek		= readSeek;
 	ctx.readEof			= readEof;
+	ctx.readSkippable	= readSkippable;
+	ctx.readAt			= readAt;
+	ctx.readSize		= readSize;
 	ctx.write			= write;
+	ctx.writeGather		= writeGather;
 	ctx.compress		= LZ4_compress_limitedOutput;
 	ctx.compressBound	= LZ4_compressBound;
 	ctx.decompress		= LZ4_decompress_safe;
+	ctx.stateCreate				= createState;
+	ctx.stateFree				= freeState;
+	ctx.compressWithState		= compressWithState;
+	ctx.compressWithPrefix		= compressWithPrefix;
+	ctx.decompressWithPrefix	= LZ4_decompress_safe_withPrefix64k;
+	ctx.decompressFast			= LZ4_decompress_fast;
+	ctx.decompressFastWithPrefix	= LZ4_decompress_fast_withPrefix64k;
+	ctx.dictionaryCreate		= createDictionary;
+	ctx.dictionaryFree			= freeDictionary;
+	ctx.compressWithDictionary	= compressWithDictionary;
 	if(Option::CompMode::COMPRESS_C1 == opt.compMode) {
 		ctx.compress = LZ4_compressHC_limitedOutput;
 	}
 
+	std::unique_ptr<Lz4MtExecutor, void (*)(Lz4MtExecutor*)> executor(
+		nullptr, lz4mtFreeExecutor);
+	if(opt.shared) {
+		executor.reset(lz4mtCreateExecutor(
+			opt.threadCount, opt.sharedMemoryLimit, opt.affinityMask));
+		ctx.executor = executor.get();
+	}
+
+	// The reader and the I/O threads share the CPUs of the workers.
+	if(opt.affinityMask && !Lz4Mt::setCurrentThreadAffinity(opt.affinityMask)) {
+		opt.display("lz4mt: Can't set CPU affinity, ignored\n");
+	}
+
+	if(!opt.dictFilename.empty()) {
+		std::ifstream ifs(opt.dictFilename, std::ios::binary);
+		const std::vector<char> dict(
+			(std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+		if(!ifs) {
+			opt.display("lz4mt: Can't read dictionary file ["
+						+ opt.dictFilename + "]\n");
+			return EXIT_FAILURE;
+		}
+		const auto dictSize = static_cast<int>(dict.size());
+		const auto dictId = Lz4Mt::Xxh32(dict.data(), dictSize, 0).digest();
+		lz4mtAddDictionary(&ctx, dictId, dict.data(), dictSize);
+		opt.sd.flg.presetDictionary = 1;
+		opt.sd.dictId = dictId;
+	}
+
 	if(opt.benchmark.enable) {
 		opt.benchmark.openIstream	= openIstream;
 		opt.benchmark.closeIstream	= closeIstream;
 		opt.benchmark.getFilesize	= getFilesize;
-		opt.benchmark.measure(ctx, opt.sd);
-		return EXIT_SUCCESS;
+		opt.benchmark.stats			= opt.stats;
+		const auto r = opt.benchmark.measure(ctx, opt.sd);
+		lz4mtFreeDictionaries(&ctx);
+		return 0 == r ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	const FileIo io(opt.mmapIo, opt.asyncIo);
+	Lz4Mt::Async::enableDirectIo(opt.directIo);
+
+	// Batch mode shares it between concurrent streams.
+	Lz4MtStats stats = lz4mtInitStats();
+	if(opt.stats) {
+		ctx.stats = &stats;
 	}
 
-	if(!openIstream(&ctx, opt.inpFilename)) {
+	if(opt.batch) {
+		const auto r = lz4mtBatch(opt, ctx, io);
+		lz4mtFreeDictionaries(&ctx);
+		if(opt.stats) {
+			showStats(stats);
+		}
+		return r;
+	}
+
+	if(opt.storeStreamSize && opt.isCompress()) {
+		if(const auto size = getFilesize(opt.inpFilename)) {
+			opt.sd.flg.streamSize = 1;
+			opt.sd.streamSize = size;
+		}
+	}
+
+	if(!io.openI(&ctx, opt.inpFilename)) {
 		opt.display("lz4mt: Can't open input file ["
 					+ opt.inpFilename + "]\n");
 		return EXIT_FAILURE;
@@ -461,25 +1252,21 @@ int lz4mtCommandLine(int argc, char* argv[]) {
 		}
 	}
 
-	if(!openOstream(&ctx, opt.outFilename, opt.nullWrite)) {
+	if(!io.openO(&ctx, opt.outFilename, opt.nullWrite)) {
 		opt.display("lz4mt: Can't open output file ["
 					+ opt.outFilename + "]\n");
 		return EXIT_FAILURE;
 	}
 
-	const auto e = [&]() -> Lz4MtResult {
-		if(opt.isCompress()) {
-			return lz4mtCompress(&ctx, &opt.sd);
-		} else if(opt.isDecompress()) {
-			return lz4mtDecompress(&ctx, &opt.sd);
-		} else {
-			opt.display("lz4mt: You must specify a switch -c or -d\n");
-			return LZ4MT_RESULT_BAD_ARG;
-		}
-	} ();
+	const auto e = processStream(opt, &ctx, &opt.sd);
+
+	io.closeO(&ctx);
+	io.closeI(&ctx);
+	lz4mtFreeDictionaries(&ctx);
 
-	closeOstream(&ctx);
-	closeIstream(&ctx);
+	if(opt.stats) {
+		showStats(stats);
+	}
 
 	if(LZ4MT_RESULT_OK != e) {
 		opt.display("lz4mt: " + std::string(lz4mtResultToString(e)) + "\n");
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Round trips through --lz4mt-async, which lends blocks out of its read
+# ahead chunks : compressible and incompressible data, so that blocks go
+# out compressed and raw, from files and pipes, with blocks which cross
+# the 4MB chunks, and concatenated frames.  Run by "make test-async".
+#
+# usage : async_roundtrip.sh [lz4mt]
+
+LZ4MT=${1:-./lz4mt}
+case "$LZ4MT" in
+	/*) ;;
+	*) LZ4MT="$(pwd)/$LZ4MT" ;;
+esac
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/lz4mt-async.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+nFail=0
+fail() {
+	echo "FAIL : $*"
+	nFail=$((nFail + 1))
+}
+
+# Same bytes on every run : text, and noise from an LCG small
+# enough for awk's doubles.
+seq 1 1500000 > text.bin
+LC_ALL=C awk 'BEGIN {
+	x = 1
+	for(i = 0; i < 9000000; ++i) {
+		x = (x * 69069 + 1) % 4294967296
+		printf "%c", 1 + int(x / 16777216) % 255
+	}
+}' > noise.bin
+cat text.bin noise.bin text.bin > mix.bin
+head -c 100 noise.bin > small.bin
+: > empty.bin
+
+for f in text.bin noise.bin mix.bin small.bin empty.bin; do
+	for opts in "-B4" "-B5" "-B6" "-B7" "-B4X" "-B6D" "-c1 -B5" "-B7 -Sx"; do
+		w="--lz4mt-workers=3"
+		"$LZ4MT" -y $opts $w --lz4mt-async "$f" o.lz4 2> /dev/null \
+			|| { fail "compress $f $opts"; continue; }
+		"$LZ4MT" -y -d $w --lz4mt-async o.lz4 o.out 2> /dev/null \
+			|| { fail "decompress $f $opts"; continue; }
+		cmp -s "$f" o.out || fail "file round trip $f $opts"
+
+		# The same frame as the other backends write.
+		"$LZ4MT" -y $opts $w "$f" ref.lz4 2> /dev/null \
+			&& cmp -s o.lz4 ref.lz4 || fail "frame differs from cstdio $f $opts"
+
+		cat "$f" | "$LZ4MT" -y $opts $w --lz4mt-async stdin stdout 2> /dev/null \
+			| "$LZ4MT" -y -d $w --lz4mt-async stdin stdout 2> /dev/null \
+			| cmp -s "$f" - || fail "pipe round trip $f $opts"
+	done
+done
+
+# Frames back to back, the second one starting inside a chunk.
+for opts in "-B4" "-B7"; do
+	"$LZ4MT" -y $opts mix.bin a.lz4 2> /dev/null
+	"$LZ4MT" -y $opts noise.bin b.lz4 2> /dev/null
+	"$LZ4MT" -y $opts text.bin c.lz4 2> /dev/null
+	cat a.lz4 b.lz4 c.lz4 > abc.lz4
+	cat mix.bin noise.bin text.bin > abc.bin
+	"$LZ4MT" -y -d --lz4mt-workers=3 --lz4mt-async abc.lz4 abc.out 2> /dev/null \
+		&& cmp -s abc.bin abc.out || fail "concatenated frames $opts"
+	cat abc.lz4 | "$LZ4MT" -y -d --lz4mt-workers=3 --lz4mt-async stdin stdout 2> /dev/null \
+		| cmp -s abc.bin - || fail "concatenated frames through a pipe $opts"
+done
+
+if [ $nFail -ne 0 ]; then
+	echo "async round trip : $nFail failures"
+	exit 1
+fi
+echo "async round trip : OK"
@@ -0,0 +1,100 @@
+// lz4mtCompressFrameBound() and lz4mtSeekTableBound() hold when blocks
+// are split : incompressible data, compressed while the codec slows
+// down, fits in exactly the bound.  Run by "make test-bound".
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "lz4.h"
+#include "lz4mt.h"
+
+namespace {
+
+const int nFastBlocks = 8;
+
+std::atomic<int> nCompress(0);
+
+// Slower per byte after the first blocks, so that the splitter starts
+// cutting them.
+int slowCompress(const char* src, char* dst, int isize, int maxOutputSize) {
+	if(++nCompress > nFastBlocks) {
+		std::this_thread::sleep_for(std::chrono::microseconds(isize / 64));
+	}
+	return LZ4_compress_limitedOutput(src, dst, isize, maxOutputSize);
+}
+
+std::vector<char> makeNoise(size_t size) {
+	std::vector<char> d(size);
+	unsigned x = 1;
+	for(auto& c : d) {
+		x = x * 1103515245 + 12345;
+		c = static_cast<char>(x >> 16);
+	}
+	return d;
+}
+
+int nFail = 0;
+
+void expect(bool ok, const std::string& what) {
+	if(!ok) {
+		printf("FAIL : %s\n", what.c_str());
+		++nFail;
+	}
+}
+
+void testSplitBound(Lz4MtMode mode) {
+	const std::string name = (LZ4MT_MODE_SEEK_TABLE & mode)
+		? "split, seek table" : "split";
+	const auto data = makeNoise(16 << 20);
+
+	auto ctx = lz4mtInitContext();
+	ctx.compress		= slowCompress;
+	ctx.compressBound	= LZ4_compressBound;
+	ctx.decompress		= LZ4_decompress_safe;
+	ctx.threadCount		= 3;
+	ctx.mode			= mode;
+	auto sd = lz4mtInitStreamDescriptor();
+	sd.bd.blockMaximumSize = 6;
+	sd.split.blockMaximumSize = 4;
+
+	auto bound = lz4mtCompressFrameBound(&sd, data.size());
+	if(LZ4MT_MODE_SEEK_TABLE & mode) {
+		bound += lz4mtSeekTableBound(&sd, data.size());
+	}
+	std::vector<char> frame(static_cast<size_t>(bound));
+	size_t frameSize = 0;
+	nCompress = 0;
+	const auto r = lz4mtCompressBuffer(&ctx, &sd, data.data(), data.size()
+									   , frame.data(), frame.size(), &frameSize);
+	expect(LZ4MT_RESULT_OK == r, name + " : compress into the bound, "
+		   + lz4mtResultToString(r));
+
+	// Not a test of the bound unless blocks were split.
+	const auto nFrameBlocks = data.size() / (1 << 20);
+	expect(nCompress > static_cast<int>(nFrameBlocks), name + " : blocks were split");
+
+	std::vector<char> out(data.size());
+	size_t outSize = 0;
+	auto dsd = lz4mtInitStreamDescriptor();
+	const auto d = lz4mtDecompressBuffer(&ctx, &dsd, frame.data(), frameSize
+										 , out.data(), out.size(), &outSize);
+	expect(LZ4MT_RESULT_OK == d && out == data, name + " : content");
+}
+
+} // anonymous namespace
+
+
+int main() {
+	testSplitBound(LZ4MT_MODE_DEFAULT);
+	testSplitBound(LZ4MT_MODE_SEEK_TABLE);
+
+	if(nFail) {
+		printf("bound test : %d failures\n", nFail);
+		return EXIT_FAILURE;
+	}
+	printf("bound test : OK\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+// Lz4Mt::Mmap output of lz4mtDecompress() : a frame whose header claims
+// more content than its blocks hold fails, and leaves an output file of
+// the bytes it did decode, not of the size it claimed.  Run by
+// "make test-mmap".
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lz4.h"
+#include "lz4mt.h"
+#include "lz4mt_io_mmap.h"
+#include "lz4mt_xxh32.h"
+
+namespace {
+
+const size_t headerSize = 4 + 2 + 8 + 1;	// with a stream size
+
+int nFail = 0;
+
+void expect(bool ok, const std::string& what) {
+	if(!ok) {
+		printf("FAIL : %s\n", what.c_str());
+		++nFail;
+	}
+}
+
+std::vector<char> makeData(size_t size) {
+	std::vector<char> d(size);
+	for(size_t i = 0; i < size; ++i) {
+		d[i] = static_cast<char>('a' + (i / 5 + i / 331) % 23);
+	}
+	return d;
+}
+
+Lz4MtContext makeContext() {
+	auto ctx = lz4mtInitContext();
+	ctx.compress		= LZ4_compress_limitedOutput;
+	ctx.compressBound	= LZ4_compressBound;
+	ctx.decompress		= LZ4_decompress_safe;
+	ctx.threadCount		= 2;
+	return ctx;
+}
+
+// A frame of data with its content size in the header.
+std::vector<char> compress(const std::vector<char>& data) {
+	auto ctx = makeContext();
+	auto sd = lz4mtInitStreamDescriptor();
+	sd.bd.blockMaximumSize = 4;
+	sd.flg.streamSize = 1;
+	sd.streamSize = data.size();
+	std::vector<char> frame(static_cast<size_t>(lz4mtCompressFrameBound(&sd, data.size())));
+	size_t frameSize = 0;
+	lz4mtCompressBuffer(&ctx, &sd, data.data(), data.size()
+						, frame.data(), frame.size(), &frameSize);
+	frame.resize(frameSize);
+	return frame;
+}
+
+// Stores size as the content size of frame, and the header checksum
+// which goes with it.
+void setStreamSize(std::vector<char>& frame, uint64_t size) {
+	for(int i = 0; i < 8; ++i) {
+		frame[6 + i] = static_cast<char>(size >> (8 * i));
+	}
+	const auto h = Lz4Mt::Xxh32(frame.data() + 4, headerSize - 5, 0).digest();
+	frame[headerSize - 1] = static_cast<char>((h >> 8) & 0xff);
+}
+
+bool writeFile(const std::string& filename, const std::vector<char>& d) {
+	auto* fp = fopen(filename.c_str(), "wb");
+	if(!fp) {
+		return false;
+	}
+	const auto n = fwrite(d.data(), 1, d.size(), fp);
+	return 0 == fclose(fp) && d.size() == n;
+}
+
+// Decompresses src to dst through the mmap backend, and returns the
+// size of dst.
+Lz4MtResult decompress(const std::string& src, const std::string& dst, off_t* dstSize) {
+	auto ctx = makeContext();
+	auto sd = lz4mtInitStreamDescriptor();
+	Lz4Mt::Mmap::openIstream(&ctx, src);
+	Lz4Mt::Mmap::openOstream(&ctx, dst, false);
+	const auto r = lz4mtDecompress(&ctx, &sd);
+	Lz4Mt::Mmap::closeOstream(&ctx);
+	Lz4Mt::Mmap::closeIstream(&ctx);
+	struct stat s;
+	*dstSize = (0 == stat(dst.c_str(), &s)) ? s.st_size : -1;
+	return r;
+}
+
+void testStreamSize(const std::string& dir, uint64_t claimed) {
+	const auto name = "content size " + std::to_string(claimed);
+	const auto data = makeData(300000);
+	auto frame = compress(data);
+	expect(frame.size() > headerSize, name + " : compress");
+	setStreamSize(frame, claimed);
+
+	const auto src = dir + "/in.lz4";
+	const auto dst = dir + "/out";
+	expect(writeFile(src, frame), name + " : write the frame");
+	off_t size = 0;
+	const auto r = decompress(src, dst, &size);
+	if(claimed == data.size()) {
+		expect(LZ4MT_RESULT_OK == r, name + " : decompress");
+	} else {
+		expect(LZ4MT_RESULT_STREAM_SIZE_MISMATCH == r, name + " : mismatch");
+	}
+	const auto expected = static_cast<off_t>(std::min<uint64_t>(claimed, data.size()));
+	expect(expected == size, name + " : output size " + std::to_string(size));
+	unlink(src.c_str());
+	unlink(dst.c_str());
+}
+
+} // anonymous namespace
+
+
+int main() {
+	const char* tmp = getenv("TMPDIR");
+	std::string dir = std::string(tmp ? tmp : "/tmp") + "/lz4mt-mmap.XXXXXX";
+	if(!mkdtemp(&dir[0])) {
+		printf("mmap test : cannot make a directory\n");
+		return EXIT_FAILURE;
+	}
+
+	testStreamSize(dir, 300000);
+	testStreamSize(dir, 300001);
+	testStreamSize(dir, uint64_t(1) << 40);
+	rmdir(dir.c_str());
+
+	if(nFail) {
+		printf("mmap test : %d failures\n", nFail);
+		return EXIT_FAILURE;
+	}
+	printf("mmap test : OK\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,243 @@
+// lz4mtStreamBegin/Write/Flush/End : pushed data comes back out of the
+// frame, after every flush and at the end.  Run by "make test-stream".
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "lz4.h"
+#include "lz4mt.h"
+
+namespace {
+
+// Output of the stream : a window the test reads while workers write to
+// it.  Writes fail, short, once failAt bytes would be passed.
+struct Output {
+	Output()
+		: mut()
+		, data()
+		, failAt(0)
+	{}
+
+	std::mutex mut;
+	std::vector<char> data;
+	size_t failAt;		// 0 : never
+};
+
+Output* getOutput(const Lz4MtContext* ctx) {
+	return static_cast<Output*>(ctx->writeCtx);
+}
+
+int write(const Lz4MtContext* ctx, const void* src, int srcSize) {
+	auto* o = getOutput(ctx);
+	std::lock_guard<std::mutex> lock(o->mut);
+	if(o->failAt && o->data.size() + srcSize > o->failAt) {
+		return 0;
+	}
+	const auto* p = static_cast<const char*>(src);
+	o->data.insert(o->data.end(), p, p + srcSize);
+	return srcSize;
+}
+
+int writeGather(const Lz4MtContext* ctx, const Lz4MtSpan* spans, int nSpan) {
+	int n = 0;
+	for(int i = 0; i < nSpan; ++i) {
+		const auto r = write(ctx, spans[i].ptr, spans[i].size);
+		n += r;
+		if(r != spans[i].size) {
+			break;
+		}
+	}
+	return n;
+}
+
+// Runs of text-like bytes and of noise, so that blocks go out compressed
+// and raw.
+std::vector<char> makeData(size_t size, unsigned seed) {
+	std::vector<char> d(size);
+	unsigned x = seed;
+	size_t i = 0;
+	while(i < size) {
+		x = x * 1103515245 + 12345;
+		const auto n = std::min<size_t>(size - i, 1 + (x >> 8) % 200000);
+		const bool noise = 0 == (x >> 4) % 3;
+		for(size_t j = 0; j < n; ++j, ++i) {
+			x = x * 1103515245 + 12345;
+			d[i] = noise ? static_cast<char>(x >> 16)
+						 : static_cast<char>('a' + (i / 7 + (x >> 28)) % 16);
+		}
+	}
+	return d;
+}
+
+unsigned lcg(unsigned& x) {
+	x = x * 1103515245 + 12345;
+	return x >> 8;
+}
+
+Lz4MtContext makeContext(Output* o, bool gather) {
+	auto ctx = lz4mtInitContext();
+	ctx.writeCtx		= o;
+	ctx.write			= write;
+	ctx.writeGather		= gather ? writeGather : nullptr;
+	ctx.compress		= LZ4_compress_limitedOutput;
+	ctx.compressBound	= LZ4_compressBound;
+	ctx.decompress		= LZ4_decompress_safe;
+	ctx.threadCount		= 3;
+	return ctx;
+}
+
+Lz4MtStreamDescriptor makeDescriptor(int blockMaximumSize, bool checksum) {
+	auto sd = lz4mtInitStreamDescriptor();
+	sd.bd.blockMaximumSize = static_cast<char>(blockMaximumSize);
+	sd.flg.streamChecksum = checksum ? 1 : 0;
+	return sd;
+}
+
+// Decodes frame, closed by an end mark when it is still open, and
+// compares it with the first size bytes of data.
+bool check(std::vector<char> frame, bool open, const std::vector<char>& data, size_t size) {
+	if(open) {
+		frame.insert(frame.end(), 4, 0);
+	}
+	auto ctx = lz4mtInitContext();
+	ctx.decompress = LZ4_decompress_safe;
+	auto sd = lz4mtInitStreamDescriptor();
+	std::vector<char> out(size + 1);
+	size_t outSize = 0;
+	const auto r = lz4mtDecompressBuffer(&ctx, &sd, frame.data(), frame.size()
+										 , out.data(), out.size(), &outSize);
+	return LZ4MT_RESULT_OK == r && size == outSize
+		&& 0 == memcmp(out.data(), data.data(), size);
+}
+
+std::vector<char> snapshot(Output& o) {
+	std::lock_guard<std::mutex> lock(o.mut);
+	return o.data;
+}
+
+int nFail = 0;
+
+void expect(bool ok, const std::string& what) {
+	if(!ok) {
+		printf("FAIL : %s\n", what.c_str());
+		++nFail;
+	}
+}
+
+// Random pieces, some of them larger than a block, and flushes which
+// mostly land in the middle of a block.
+void testRandomPush(unsigned seed, int blockMaximumSize, bool gather) {
+	const auto name = "random push, seed " + std::to_string(seed)
+		+ ", -B" + std::to_string(blockMaximumSize) + (gather ? ", gather" : "");
+	const auto data = makeData(6 * 1000 * 1000, seed);
+	Output o;
+	auto ctx = makeContext(&o, gather);
+	const auto sd = makeDescriptor(blockMaximumSize, false);
+	auto* s = lz4mtStreamBegin(&ctx, &sd);
+	expect(nullptr != s, name + " : begin");
+	if(!s) {
+		return;
+	}
+	unsigned x = seed;
+	size_t pos = 0;
+	while(pos < data.size()) {
+		const auto big = 0 == lcg(x) % 5;
+		const auto n = std::min<size_t>(data.size() - pos, big ? lcg(x) % 3000000 : lcg(x) % 5000);
+		expect(LZ4MT_RESULT_OK == lz4mtStreamWrite(s, data.data() + pos, n), name + " : write");
+		pos += n;
+		if(0 == lcg(x) % 6) {
+			expect(LZ4MT_RESULT_OK == lz4mtStreamFlush(s), name + " : flush");
+			expect(check(snapshot(o), true, data, pos), name + " : content after flush");
+		}
+	}
+	expect(LZ4MT_RESULT_OK == lz4mtStreamEnd(s), name + " : end");
+	expect(check(o.data, false, data, data.size()), name + " : content");
+}
+
+// A flush sends the data of a block which is far from full.
+void testFlushMidBlock() {
+	const std::string name = "flush mid-block";
+	const auto data = makeData(10000, 7);
+	Output o;
+	auto ctx = makeContext(&o, true);
+	const auto sd = makeDescriptor(7, false);
+	auto* s = lz4mtStreamBegin(&ctx, &sd);
+	expect(LZ4MT_RESULT_OK == lz4mtStreamWrite(s, data.data(), 1000), name + " : write");
+	expect(LZ4MT_RESULT_OK == lz4mtStreamFlush(s), name + " : flush");
+	expect(check(snapshot(o), true, data, 1000), name + " : content after flush");
+	expect(LZ4MT_RESULT_OK == lz4mtStreamFlush(s), name + " : flush with nothing pending");
+	expect(LZ4MT_RESULT_OK == lz4mtStreamWrite(s, data.data() + 1000, 9000), name + " : write");
+	expect(LZ4MT_RESULT_OK == lz4mtStreamEnd(s), name + " : end");
+	expect(check(o.data, false, data, data.size()), name + " : content");
+}
+
+void testEndWithoutFlush(size_t size) {
+	const auto name = "end without flush, " + std::to_string(size) + " bytes";
+	const auto data = makeData(size, 11);
+	Output o;
+	auto ctx = makeContext(&o, false);
+	const auto sd = makeDescriptor(4, true);
+	auto* s = lz4mtStreamBegin(&ctx, &sd);
+	expect(LZ4MT_RESULT_OK == lz4mtStreamWrite(s, data.data(), data.size()), name + " : write");
+	expect(LZ4MT_RESULT_OK == lz4mtStreamEnd(s), name + " : end");
+	expect(LZ4MT_RESULT_OK == ctx.result, name + " : result in the context");
+	expect(check(o.data, false, data, data.size()), name + " : content");
+}
+
+// The output stops taking data : write, flush and end fail instead of
+// waiting for ever.
+void testFailingOutput(size_t failAt, bool gather) {
+	const auto name = "failing output at " + std::to_string(failAt)
+		+ (gather ? ", gather" : "");
+	const auto data = makeData(4 * 1000 * 1000, 13);
+	Output o;
+	o.failAt = failAt;
+	auto ctx = makeContext(&o, gather);
+	const auto sd = makeDescriptor(4, false);
+	auto* s = lz4mtStreamBegin(&ctx, &sd);
+	auto r = LZ4MT_RESULT_OK;
+	for(size_t pos = 0; LZ4MT_RESULT_OK == r && pos < data.size(); pos += 50000) {
+		r = lz4mtStreamWrite(s, data.data() + pos, 50000);
+		if(LZ4MT_RESULT_OK == r) {
+			r = lz4mtStreamFlush(s);
+		}
+	}
+	expect(LZ4MT_RESULT_OK != r, name + " : write or flush fails");
+	expect(LZ4MT_RESULT_OK != lz4mtStreamFlush(s), name + " : later flush fails");
+	expect(LZ4MT_RESULT_OK != lz4mtStreamEnd(s), name + " : end fails");
+	expect(LZ4MT_RESULT_OK != ctx.result, name + " : result in the context");
+}
+
+void testBadDescriptor() {
+	Output o;
+	auto ctx = makeContext(&o, false);
+	const auto sd = makeDescriptor(3, false);
+	expect(nullptr == lz4mtStreamBegin(&ctx, &sd), "bad descriptor : begin");
+	expect(LZ4MT_RESULT_OK != ctx.result, "bad descriptor : result");
+}
+
+} // anonymous namespace
+
+
+int main() {
+	for(unsigned seed = 1; seed <= 3; ++seed) {
+		testRandomPush(seed, 4, 0 != (seed & 1));
+		testRandomPush(seed, 7, 0 == (seed & 1));
+	}
+	testFlushMidBlock();
+	testEndWithoutFlush(0);
+	testEndWithoutFlush(3 * 1000 * 1000 + 17);
+	testFailingOutput(5, false);
+	testFailingOutput(300000, false);
+	testFailingOutput(300000, true);
+	testBadDescriptor();
+
+	if(nFail) {
+		printf("stream test : %d failures\n", nFail);
+		return EXIT_FAILURE;
+	}
+	printf("stream test : OK\n");
+	return EXIT_SUCCESS;
+}